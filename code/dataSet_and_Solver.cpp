@@ -34,7 +34,11 @@ class Solver
 	):
 		KeyFrameTime(p_KeyFrameTime),
 		Problem(p_problem)
-	{}
+	{
+		Problem->reserveKeyframes(KeyFrameTime.size());
+	}
+
+	virtual ~Solver() {}
 	
 	/**
 	* This method calculates the time evolution of the system (i.e. the solution
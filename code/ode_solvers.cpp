@@ -1,4 +1,21 @@
 #include<armadillo>
+#include<thread>
+#include<atomic>
+#include<deque>
+#include<algorithm>
+#include<limits>
+#include<map>
+#include<cmath>
+#include<functional>
+#include<memory>
+#include<mutex>
+#include<condition_variable>
+#include<exception>
+
+//spsolve_factoriser was added in armadillo 14 and needs SuperLU.
+#if defined(ARMA_USE_SUPERLU) && defined(ARMA_VERSION_MAJOR) && ARMA_VERSION_MAJOR >= 14
+#define FLUXSURFER_SPARSE_FACTORISATION
+#endif
 
 /**
 * This class defines how a numerical single step scheme for the integration of a
@@ -9,6 +26,52 @@
 class SingleStepScheme
 {
 	public:
+
+	/**
+	* The vectors a scheme needs during a step, f.e. the derivatives of its
+	* stages. A solver keeps one workspace per integration and passes it to
+	* every step, so the vectors are allocated in the first step and reused
+	* in all following ones.
+	*/
+	class Workspace
+	{
+		protected:
+
+		/**
+		* A deque, so that the references to the vectors stay valid if more
+		* vectors are added.
+		*/
+		std::deque<arma::Col<double>> Vectors;
+
+		public:
+
+		/**
+		* Returns the vector with the given number. It has n elements, memory
+		* is only allocated if it had another size before.
+		*/
+		arma::Col<double>& vector(std::size_t number,arma::uword n)
+		{
+			while(Vectors.size() <= number)
+			{
+				Vectors.emplace_back();
+			}
+
+			if(Vectors[number].n_elem != n)
+			{
+				Vectors[number].set_size(n);
+			}
+
+			return Vectors[number];
+		}
+
+		/**
+		* Exchanges two vectors without copying them.
+		*/
+		void swap(std::size_t a,std::size_t b)
+		{
+			Vectors[a].swap(Vectors[b]);
+		}
+	};
 	
 	/**
 	* The convergence order of the method. This information is of special
@@ -17,22 +80,105 @@ class SingleStepScheme
 	virtual int convergenceOrder()=0;
 	
 	/**
-	* This Method calculates one solver step with the scheme. See the
-	* EulerForeward scheme for examples.
+	* This Method calculates one solver step with the scheme and writes the
+	* result to out. See the EulerForeward scheme for examples. The problem is
+	* a QuantumSystem or a part of it, like a QuantumSystem::Sector. A scheme
+	* may be used by multiple threads at once, so it should not change its own
+	* members in this method. Everything it needs is taken from the workspace,
+	* so a step does not allocate memory once the workspace and out have the
+	* right size. out may be the same vector as x_n.
+	*/
+	virtual void step(double t_n,const arma::Col<double>& x_n,DifferentialEquation* problem,double h,arma::Col<double>& out,Workspace& workspace)=0;
+
+	/**
+	* Calculates one step and returns the result as new vector. This
+	* allocates on every call, the solvers use the version above.
 	*/
-	virtual arma::Col<double> step(double t_n,arma::Col<double>& x_n,QuantumSystem* problem,double h)=0;
+	arma::Col<double> step(double t_n,const arma::Col<double>& x_n,DifferentialEquation* problem,double h)
+	{
+		Workspace workspace;
+		arma::Col<double> out;
+		step(t_n,x_n,problem,h,out,workspace);
+		return out;
+	}
 };
 
+/**
+* Calculates out = x + h*k elementwise. out may be x or k. Plain loops are
+* used, so no temporaries are created.
+*/
+inline void addScaled(const arma::Col<double>& x,double h,const arma::Col<double>& k,arma::Col<double>& out)
+{
+	if(out.n_elem != x.n_elem)
+	{
+		out.set_size(x.n_elem);
+	}
+
+	const double* px = x.memptr();
+	const double* pk = k.memptr();
+	double* po = out.memptr();
+
+	for(arma::uword i = 0;i < x.n_elem;i++)
+	{
+		po[i] = px[i] + h*pk[i];
+	}
+}
+
+/**
+* Calculates out = x + h*(c[0]*k[0] + ... + c[count-1]*k[count-1])
+* elementwise. Coefficients that are 0 are skipped. out may be x, but none of
+* the k.
+*/
+inline void addScaled(const arma::Col<double>& x,double h,const double* c,arma::Col<double>* const* k,int count,arma::Col<double>& out)
+{
+	if(out.n_elem != x.n_elem)
+	{
+		out.set_size(x.n_elem);
+	}
+
+	const double* pk[8];
+	double hc[8];
+	int used = 0;
+
+	for(int j = 0;j < count;j++)
+	{
+		if(c[j] != 0)
+		{
+			pk[used] = k[j]->memptr();
+			hc[used] = h*c[j];
+			used++;
+		}
+	}
+
+	const double* px = x.memptr();
+	double* po = out.memptr();
+
+	for(arma::uword i = 0;i < x.n_elem;i++)
+	{
+		double sum = 0;
+		for(int j = 0;j < used;j++)
+		{
+			sum += hc[j]*pk[j][i];
+		}
+		po[i] = px[i] + sum;
+	}
+}
+
 /**
 * A implementation of the simple euler foreward scheme.
 */
 class EulerForward : public SingleStepScheme
 {
 	public:
+
+	using SingleStepScheme::step;
 	
-	arma::Col<double> step(double t_n,arma::Col<double>& x_n,QuantumSystem* problem,double h) override
+	void step(double t_n,const arma::Col<double>& x_n,DifferentialEquation* problem,double h,arma::Col<double>& out,Workspace& workspace) override
 	{
-		return x_n + h*problem->ODE(t_n,x_n);
+		arma::Col<double>& derivative = workspace.vector(0,x_n.n_elem);
+
+		problem->ODE(t_n,x_n,derivative);
+		addScaled(x_n,h,derivative,out);
 	}
 	
 	int convergenceOrder() override
@@ -41,6 +187,171 @@ class EulerForward : public SingleStepScheme
 	}
 };
 
+/**
+* The classical Runge-Kutta scheme of fourth order. It evaluates the problem
+* four times per step.
+*/
+class RungeKutta4 : public SingleStepScheme
+{
+	public:
+
+	using SingleStepScheme::step;
+
+	void step(double t_n,const arma::Col<double>& x_n,DifferentialEquation* problem,double h,arma::Col<double>& out,Workspace& workspace) override
+	{
+		arma::uword n = x_n.n_elem;
+		arma::Col<double>* k[4] = {&workspace.vector(0,n),&workspace.vector(1,n),&workspace.vector(2,n),&workspace.vector(3,n)};
+		arma::Col<double>& stage = workspace.vector(4,n);
+
+		problem->ODE(t_n,x_n,*k[0]);
+		addScaled(x_n,h/2,*k[0],stage);
+		problem->ODE(t_n+h/2,stage,*k[1]);
+		addScaled(x_n,h/2,*k[1],stage);
+		problem->ODE(t_n+h/2,stage,*k[2]);
+		addScaled(x_n,h,*k[2],stage);
+		problem->ODE(t_n+h,stage,*k[3]);
+
+		const double b[4] = {1.0/6,1.0/3,1.0/3,1.0/6};
+		addScaled(x_n,h,b,k,4,out);
+	}
+
+	int convergenceOrder() override
+	{
+		return 4;
+	}
+};
+
+/**
+* A scheme that calculates two solutions of different order in one step. The
+* difference of the solutions estimates the error of the step, which is used
+* by the EmbeddedRungeKuttaSolver to control the stepwidth.
+*/
+class EmbeddedScheme : public SingleStepScheme
+{
+	public:
+
+	/**
+	* The order of the solution the error is estimated with. The controller
+	* of the stepwidth needs it.
+	*/
+	virtual int embeddedOrder()=0;
+
+	/**
+	* Returns true if the last stage of a step is the derivative at the end
+	* of the step, so that it can be used as the first stage of the next step
+	* (first same as last).
+	*/
+	virtual bool firstSameAsLast()
+	{
+		return false;
+	}
+
+	/**
+	* Calculates one step like step and writes the estimated error of the
+	* step to error. out may not be x_n.
+	*
+	* @param firstStageKnown If this is true, workspace.vector(0) already
+	* holds the derivative at (t_n,x_n). It is left unchanged by the step. If
+	* firstSameAsLast is true, workspace.vector(1) holds the derivative at
+	* (t_n+h,out) afterwards.
+	*/
+	virtual void stepWithError(double t_n,const arma::Col<double>& x_n,DifferentialEquation* problem,double h,arma::Col<double>& out,arma::Col<double>& error,Workspace& workspace,bool firstStageKnown)=0;
+};
+
+/**
+* The embedded Runge-Kutta scheme of Dormand and Prince. The solution is of
+* fifth order, the error is estimated with an embedded solution of fourth
+* order. It needs seven evaluations of the problem per step, but the last one
+* is the first one of the next step, so an accepted step costs six.
+*/
+class DormandPrince54 : public EmbeddedScheme
+{
+	protected:
+
+	static constexpr double C[7] = {0,1.0/5,3.0/10,4.0/5,8.0/9,1,1};
+
+	static constexpr double A[6][6] = {
+		{0,0,0,0,0,0},
+		{1.0/5,0,0,0,0,0},
+		{3.0/40,9.0/40,0,0,0,0},
+		{44.0/45,-56.0/15,32.0/9,0,0,0},
+		{19372.0/6561,-25360.0/2187,64448.0/6561,-212.0/729,0,0},
+		{9017.0/3168,-355.0/33,46732.0/5247,49.0/176,-5103.0/18656,0}
+	};
+
+	/**
+	* The weights of the solution of fifth order.
+	*/
+	static constexpr double B[7] = {35.0/384,0,500.0/1113,125.0/192,-2187.0/6784,11.0/84,0};
+
+	/**
+	* The weights of the solution of fifth order minus the ones of the
+	* solution of fourth order.
+	*/
+	static constexpr double E[7] = {71.0/57600,0,-71.0/16695,71.0/1920,-17253.0/339200,22.0/525,-1.0/40};
+
+	public:
+
+	using SingleStepScheme::step;
+
+	void stepWithError(double t_n,const arma::Col<double>& x_n,DifferentialEquation* problem,double h,arma::Col<double>& out,arma::Col<double>& error,Workspace& workspace,bool firstStageKnown) override
+	{
+		arma::uword n = x_n.n_elem;
+
+		//The first and the last stage are kept in the vectors 0 and 1 of
+		//the workspace, see stepWithError.
+		arma::Col<double>* k[7];
+		k[0] = &workspace.vector(0,n);
+		k[6] = &workspace.vector(1,n);
+		for(int i = 1;i < 6;i++)
+		{
+			k[i] = &workspace.vector(i+1,n);
+		}
+		arma::Col<double>& stage = workspace.vector(7,n);
+
+		if(!firstStageKnown)
+		{
+			problem->ODE(t_n,x_n,*k[0]);
+		}
+
+		for(int i = 1;i < 6;i++)
+		{
+			addScaled(x_n,h,A[i],k,i,stage);
+			problem->ODE(t_n+C[i]*h,stage,*k[i]);
+		}
+
+		addScaled(x_n,h,B,k,6,out);
+		problem->ODE(t_n+h,out,*k[6]);
+
+		error.zeros(n);
+		addScaled(error,h,E,k,7,error);
+	}
+
+	void step(double t_n,const arma::Col<double>& x_n,DifferentialEquation* problem,double h,arma::Col<double>& out,Workspace& workspace) override
+	{
+		arma::Col<double>& error = workspace.vector(8,x_n.n_elem);
+		arma::Col<double>& solution = workspace.vector(9,x_n.n_elem);
+
+		stepWithError(t_n,x_n,problem,h,solution,error,workspace,false);
+		out = solution;
+	}
+
+	int convergenceOrder() override
+	{
+		return 5;
+	}
+
+	int embeddedOrder() override
+	{
+		return 4;
+	}
+
+	bool firstSameAsLast() override
+	{
+		return true;
+	}
+};
+
 /**
 * This Class proveides a abstract implementation of a SingleStepSolver. It
 * incooperates the similaritys a Fixed stepwidth and a adaptive stepwidth solver
@@ -64,6 +375,22 @@ class SingleStepODESolver : public Solver
 	* The numeric integration scheme to calculate the integration steps.
 	*/
 	SingleStepScheme* Scheme;
+
+	/**
+	* The vectors the scheme uses during a step.
+	*/
+	SingleStepScheme::Workspace Work;
+
+	/**
+	* The equation the steps are taken on. It is the problem itself unless
+	* useEquation was called.
+	*/
+	DifferentialEquation* Equation;
+
+	/**
+	* The occupation that is handed to the system on a keyframe.
+	*/
+	std::vector<double> Moment;
 	
 	/**
 	* This method returns the stepwidth for the next integration step. For the
@@ -73,6 +400,18 @@ class SingleStepODESolver : public Solver
 	*/
 	virtual double stepWidth()=0;
 
+	/**
+	* Advances CurrentValue and CurrentTime by one step. Solvers that
+	* reject steps and repeat them override this.
+	*/
+	virtual void advance()
+	{
+		double h = stepWidth();
+
+		Scheme->step(CurrentTime,CurrentValue,Equation,h,CurrentValue,Work);
+		CurrentTime += h;
+	}
+
 	public:
 	
 	SingleStepODESolver(
@@ -84,7 +423,8 @@ class SingleStepODESolver : public Solver
 		Solver(p_KeyFrameTime,p_initialOccupation,p_problem),
 		CurrentTime(p_KeyFrameTime.front()),
 		CurrentValue(arma::vec(p_initialOccupation.size(),arma::fill::zeros)),
-		Scheme(p_Scheme)
+		Scheme(p_Scheme),
+		Equation(p_problem)
 	{
 		for(int i=0;i<p_initialOccupation.size();i++)
 		{
@@ -96,26 +436,46 @@ class SingleStepODESolver : public Solver
 	{
 		while(!KeyFrameTime.empty())
 		{
-			double h = stepWidth();
-
-			CurrentValue = Scheme->step(CurrentTime,CurrentValue,Problem,h);
-			CurrentTime += h;
+			advance();
 			
 			if(CurrentTime >= KeyFrameTime.front())
 			{
-				std::vector<double> toLog;
-			
-				for(int i =0; i< Problem->numberOfStates();i++)
-				{
-					toLog.push_back(CurrentValue(i));
-				}
-				
+				Moment.assign(CurrentValue.memptr(),CurrentValue.memptr()+Problem->numberOfStates());
 				
-				Problem->logMoment(CurrentTime,toLog);
+				Problem->logMoment(CurrentTime,Moment);
 				KeyFrameTime.erase(KeyFrameTime.begin());
 			}
 		}
 	}
+
+	/**
+	* Lets the steps work on a part of the system, f.e. a
+	* QuantumSystem::Sector, instead of the whole system. The initial
+	* occupation given to the constructor has to be the one of this part.
+	* It is used by the SectorSolver.
+	*/
+	void useEquation(DifferentialEquation* equation)
+	{
+		Equation = equation;
+	}
+
+	/**
+	* Integrates up to the next keyframe and removes it without logging it.
+	* Returns the value at the keyframe.
+	*/
+	const arma::Col<double>& integrateToNextKeyframe()
+	{
+		double keyframe = KeyFrameTime.front();
+
+		while(CurrentTime < keyframe)
+		{
+			advance();
+		}
+
+		KeyFrameTime.erase(KeyFrameTime.begin());
+
+		return CurrentValue;
+	}
 };
 
 class FixedStepwidthSolver : public SingleStepODESolver
@@ -204,6 +564,12 @@ class RichardsonSolver : public SingleStepODESolver
 	* stepwidth to get to the solution.
 	*/
 	int SubSteps;
+
+	/**
+	* The solutions with the large and the small stepwidth.
+	*/
+	arma::Col<double> SolutionLargeH;
+	arma::Col<double> SolutionSmallerH;
 	
 
 	/**
@@ -216,24 +582,27 @@ class RichardsonSolver : public SingleStepODESolver
 	double stepWidth() override
 	{
 		//Calculating Error
-		arma::Col<double> SolutionLargeH = Scheme->step(CurrentTime,CurrentValue,Problem,LastStepWidth);
+		Scheme->step(CurrentTime,CurrentValue,Equation,LastStepWidth,SolutionLargeH,Work);
 		
 		double SmallerH = LastStepWidth/SubSteps;
-		arma::Col<double> SolutionSmallerH = CurrentValue;
+		SolutionSmallerH = CurrentValue;
 		double TimeSmallerH = CurrentTime;
 
 		for(int i = 0;i<SubSteps; i++)
 		{
-			SolutionSmallerH =
-			Scheme->step(TimeSmallerH,SolutionSmallerH,Problem,SmallerH);
+			Scheme->step(TimeSmallerH,SolutionSmallerH,Equation,SmallerH,SolutionSmallerH,Work);
 			TimeSmallerH += SmallerH;	
 		}
 		
-
-		arma::Col<double> deviation = SolutionLargeH-SolutionSmallerH;
-		double NormDeviation = sqrt(arma::dot(deviation,deviation));
+		double NormDeviation = 0;
+		for(arma::uword i = 0;i < CurrentValue.n_elem;i++)
+		{
+			double deviation = SolutionLargeH(i)-SolutionSmallerH(i);
+			NormDeviation += deviation*deviation;
+		}
+		NormDeviation = sqrt(NormDeviation);
 		int order = Scheme->convergenceOrder();
-		double err = pow((Precision*(pow(SubSteps,order)-1))/(NormDeviation),1/order);
+		double err = pow((Precision*(pow(SubSteps,order)-1))/(NormDeviation),1.0/order);
 		
 		//choosing optimal stepwidth	
 		double toReturn = err*ShrinkRate;
@@ -286,3 +655,1586 @@ class RichardsonSolver : public SingleStepODESolver
 		SubSteps(p_SubSteps)
 	{}
 };
+
+/**
+* An adaptive stepwidth solver for embedded schemes like DormandPrince54. The
+* error of every step is estimated by the scheme. A step is accepted if the
+* error of every component i is below
+*
+*	AbsoluteTolerance_i + RelativeTolerance*|x_i|
+*
+* in the root mean square over all components. Otherwise it is repeated with
+* a smaller stepwidth. The next stepwidth is chosen by a PI controller, which
+* also takes the error of the last step into account and so avoids the
+* oscillation of the stepwidth between accepted and rejected steps
+* (Hairer, Wanner: Solving Ordinary Differential Equations I, II.4). Steps
+* end exactly on the keyframes.
+*/
+class EmbeddedRungeKuttaSolver : public SingleStepODESolver
+{
+	protected:
+
+	EmbeddedScheme* Embedded;
+
+	/**
+	* The stepwidth for the next step. It is not shortened by keyframes.
+	*/
+	double NextStepWidth;
+
+	/**
+	* The tolerated absolute error of every component. If it holds a single
+	* value, it applies to all components.
+	*/
+	std::vector<double> AbsoluteTolerance;
+
+	/**
+	* The tolerated error relative to the value of the component.
+	*/
+	double RelativeTolerance;
+
+	double MaximalStepWidth;
+
+	/**
+	* Steps of this width are accepted even if their error is too large. See
+	* RichardsonSolver::MinimalStepWidth.
+	*/
+	double MinimalStepWidth;
+
+	/**
+	* Is true when a step with a too large error was accepted because the
+	* minimal stepwidth got hit.
+	*/
+	bool MinimalStepWidthReached = false;
+
+	/**
+	* The parameters of the controller: the factor the new stepwidth is
+	* multiplied with to be on the safe side, the weight of the error of the
+	* last step and the limits of the change of the stepwidth from one step to
+	* the next.
+	*/
+	double Safety = 0.9;
+	double Beta = 0.04;
+	double MinimalFactor = 0.2;
+	double MaximalFactor = 10;
+
+	/**
+	* The error of the last accepted step, relative to the tolerance.
+	*/
+	double LastError = 1e-4;
+
+	bool LastStepRejected = false;
+
+	/**
+	* Is true if the vector 0 of the workspace holds the derivative at the
+	* current time and value.
+	*/
+	bool FirstStageKnown = false;
+
+	std::size_t AcceptedSteps = 0;
+	std::size_t RejectedSteps = 0;
+
+	/**
+	* The result and the estimated error of the last step.
+	*/
+	arma::Col<double> Proposal;
+	arma::Col<double> Error;
+
+	double stepWidth() override
+	{
+		return std::min(NextStepWidth,KeyFrameTime.front()-CurrentTime);
+	}
+
+	/**
+	* Returns the root mean square of the errors of the components relative
+	* to their tolerance. The step is accepted if it is at most 1.
+	*/
+	double relativeError()
+	{
+		double sum = 0;
+		bool perComponent = AbsoluteTolerance.size() == CurrentValue.n_elem;
+
+		for(arma::uword i = 0;i < CurrentValue.n_elem;i++)
+		{
+			double absoluteTolerance = perComponent ? AbsoluteTolerance[i] : AbsoluteTolerance[0];
+			double scale = absoluteTolerance + RelativeTolerance*std::max(std::abs(CurrentValue(i)),std::abs(Proposal(i)));
+			double e = Error(i)/scale;
+			sum += e*e;
+		}
+
+		return CurrentValue.n_elem > 0 ? sqrt(sum/CurrentValue.n_elem) : 0;
+	}
+
+	void advance() override
+	{
+		while(true)
+		{
+			double remaining = KeyFrameTime.front()-CurrentTime;
+			if(remaining <= 0)
+			{
+				return;
+			}
+
+			bool lastBeforeKeyframe = NextStepWidth >= remaining;
+			double h = lastBeforeKeyframe ? remaining : NextStepWidth;
+
+			Embedded->stepWithError(CurrentTime,CurrentValue,Equation,h,Proposal,Error,Work,FirstStageKnown);
+			FirstStageKnown = true;
+
+			double err = relativeError();
+			double exponent = 1.0/(Embedded->embeddedOrder()+1);
+			double errorFactor = pow(err,exponent - 0.75*Beta);
+
+			if(err <= 1 || h <= MinimalStepWidth)
+			{
+				if(err > 1)
+				{
+					MinimalStepWidthReached = true;
+				}
+
+				double factor = errorFactor/pow(LastError,Beta)/Safety;
+				factor = std::max(1/MaximalFactor,std::min(1/MinimalFactor,factor));
+
+				double newStepWidth = h/factor;
+				if(LastStepRejected)
+				{
+					newStepWidth = std::min(newStepWidth,h);
+				}
+
+				//A step that was shortened to hit a keyframe does not say
+				//much about the stepwidth the problem allows.
+				if(!lastBeforeKeyframe || newStepWidth < NextStepWidth)
+				{
+					NextStepWidth = newStepWidth;
+				}
+
+				LastError = std::max(err,1e-4);
+				LastStepRejected = false;
+				AcceptedSteps++;
+
+				CurrentValue.swap(Proposal);
+				CurrentTime = lastBeforeKeyframe ? KeyFrameTime.front() : CurrentTime+h;
+
+				if(Embedded->firstSameAsLast())
+				{
+					Work.swap(0,1);
+				}
+				else
+				{
+					FirstStageKnown = false;
+				}
+			}
+			else
+			{
+				NextStepWidth = h/std::min(1/MinimalFactor,errorFactor/Safety);
+				LastStepRejected = true;
+				RejectedSteps++;
+			}
+
+			NextStepWidth = std::min(std::max(NextStepWidth,MinimalStepWidth),MaximalStepWidth);
+
+			if(!LastStepRejected)
+			{
+				return;
+			}
+		}
+	}
+
+	public:
+
+	EmbeddedRungeKuttaSolver(
+		std::vector<double> p_KeyFrameTime,
+		std::vector<double> p_initialOccupation,
+		QuantumSystem* p_problem,
+		EmbeddedScheme* p_Scheme,
+		double p_InitialStep,
+		double p_AbsoluteTolerance = 1e-10,
+		double p_RelativeTolerance = 1e-6,
+		double p_MaximalStepWidth = 1e-1,
+		double p_MinimalStepWidth = 1e-12
+	):
+		SingleStepODESolver(p_KeyFrameTime,p_initialOccupation,p_problem,p_Scheme),
+		Embedded(p_Scheme),
+		NextStepWidth(p_InitialStep),
+		AbsoluteTolerance({p_AbsoluteTolerance}),
+		RelativeTolerance(p_RelativeTolerance),
+		MaximalStepWidth(p_MaximalStepWidth),
+		MinimalStepWidth(p_MinimalStepWidth)
+	{}
+
+	/**
+	* Sets a tolerated absolute error for every state, f.e. to resolve states
+	* with a small occupation more accurately than the others.
+	*/
+	void setAbsoluteTolerances(std::vector<double> tolerances)
+	{
+		if(tolerances.size() != CurrentValue.n_elem)
+		{
+			throw std::runtime_error("One absolute tolerance per state is needed.");
+		}
+
+		AbsoluteTolerance = tolerances;
+	}
+
+	/**
+	* Returns true if a step was accepted only because it reached the
+	* minimal stepwidth.
+	*/
+	bool minimalStepWidthReached()
+	{
+		return MinimalStepWidthReached;
+	}
+
+	std::size_t acceptedSteps()
+	{
+		return AcceptedSteps;
+	}
+
+	std::size_t rejectedSteps()
+	{
+		return RejectedSteps;
+	}
+};
+
+/**
+* Solves the linear systems (I - c*W)x = b of the implicit solvers, where W is
+* the matrix of a masterequation. If armadillo 14 or newer is built with
+* SuperLU, the matrix is factorised sparse once, afterwards every solve only
+* needs the forward and backward substitution. Older versions built with
+* SuperLU keep the sparse matrix and let spsolve factorise it in every solve.
+* Without SuperLU the matrix is factorised dense. That needs memory for n^2
+* values, so it is refused for systems with more than DenseLimit states.
+*/
+class ShiftedMatrixFactorisation
+{
+	protected:
+
+	bool Factorised = false;
+
+#ifdef FLUXSURFER_SPARSE_FACTORISATION
+	arma::spsolve_factoriser Factoriser;
+#elif defined(ARMA_USE_SUPERLU)
+	arma::SpMat<double> Matrix;
+#else
+	/**
+	* The factors of P*(I - c*W) = L*U. L has a unit diagonal. The
+	* permutation P is stored as the column of the one in every row.
+	*/
+	arma::Mat<double> L;
+	arma::Mat<double> U;
+	std::vector<arma::uword> Permutation;
+
+	arma::Col<double> Intermediate;
+#endif
+
+	public:
+
+	/**
+	* The largest number of states the matrix is factorised dense for. The
+	* factors of larger systems would need more than 100 MB.
+	*/
+	static constexpr arma::uword DenseLimit = 2500;
+
+	/**
+	* Factorises I - c*W.
+	*/
+	void factorise(const SparseMasterEquation& W,double c)
+	{
+		arma::uword n = W.dimension();
+		Factorised = false;
+
+#ifdef FLUXSURFER_SPARSE_FACTORISATION
+		arma::SpMat<double> matrix = arma::speye(n,n) - c*W.asSpMat();
+
+		if(!Factoriser.factorise(matrix))
+		{
+			throw std::runtime_error("The matrix of the implicit step could not be factorised.");
+		}
+#elif defined(ARMA_USE_SUPERLU)
+		Matrix = arma::speye(n,n) - c*W.asSpMat();
+#else
+		if(n > DenseLimit)
+		{
+			throw std::runtime_error("The implicit step of a system with "+std::to_string(n)+" states would be factorised dense. Build armadillo with SuperLU to solve it sparse.");
+		}
+
+		arma::Mat<double> matrix = W.asMat();
+		matrix *= -c;
+		for(arma::uword i = 0;i < n;i++)
+		{
+			matrix(i,i) += 1;
+		}
+
+		arma::Mat<double> P;
+		if(!arma::lu(L,U,P,matrix))
+		{
+			throw std::runtime_error("The matrix of the implicit step could not be factorised.");
+		}
+
+		Permutation.assign(n,0);
+		for(arma::uword i = 0;i < n;i++)
+		{
+			for(arma::uword j = 0;j < n;j++)
+			{
+				if(P(i,j) != 0)
+				{
+					Permutation[i] = j;
+				}
+			}
+		}
+
+		Intermediate.set_size(n);
+#endif
+
+		Factorised = true;
+	}
+
+	/**
+	* Solves (I - c*W)x = b with the factorisation. x may not be b. The dense
+	* version allocates no memory if x has the right size already.
+	*/
+	void solve(const arma::Col<double>& b,arma::Col<double>& x)
+	{
+#ifdef FLUXSURFER_SPARSE_FACTORISATION
+		if(!Factoriser.solve(x,b))
+		{
+			throw std::runtime_error("The linear system of the implicit step could not be solved.");
+		}
+#elif defined(ARMA_USE_SUPERLU)
+		if(!arma::spsolve(x,Matrix,b,"superlu"))
+		{
+			throw std::runtime_error("The linear system of the implicit step could not be solved.");
+		}
+#else
+		arma::uword n = b.n_elem;
+		if(x.n_elem != n)
+		{
+			x.set_size(n);
+		}
+
+		//L*y = P*b
+		for(arma::uword i = 0;i < n;i++)
+		{
+			double sum = b(Permutation[i]);
+			for(arma::uword j = 0;j < i;j++)
+			{
+				sum -= L(i,j)*Intermediate(j);
+			}
+			Intermediate(i) = sum;
+		}
+
+		//U*x = y
+		for(arma::uword i = n;i-- > 0;)
+		{
+			double sum = Intermediate(i);
+			for(arma::uword j = i+1;j < n;j++)
+			{
+				sum -= U(i,j)*x(j);
+			}
+			x(i) = sum/U(i,i);
+		}
+#endif
+	}
+
+	bool isFactorised()
+	{
+		return Factorised;
+	}
+};
+
+/**
+* The base of the implicit solvers. The masterequations of systems with fast
+* and slow processes, f.e. tunneling and spin flips, are stiff: Explicit
+* schemes are only stable with steps shorter than the fastest process, even
+* if it has long reached its equilibrium. Implicit schemes are stable with
+* any stepwidth, but every step solves a linear system with the matrix
+* I - c*W, where c is the stepwidth times a constant of the scheme. The matrix
+* is only factorised again if c or the masterequation changed, so as long as
+* the rates are constant a step costs only a few substitutions.
+*/
+class ImplicitSolver : public SingleStepODESolver
+{
+	protected:
+
+	ShiftedMatrixFactorisation Factorisation;
+
+	/**
+	* The shift c and the version of the masterequation (see
+	* QuantumSystem::masterEquationVersion) of the factorisation.
+	*/
+	double FactorisedShift = 0;
+	std::size_t FactorisedVersion = 0;
+
+	std::size_t Factorisations = 0;
+
+	/**
+	* Makes sure that the factorisation is the one of I - c*W(time). Shifts
+	* that differ by a relative 1e-9 are treated as equal, so steps that are
+	* only equal up to rounding errors share the factorisation.
+	*
+	* @return The shift of the factorisation.
+	*/
+	double factorise(double time,double c)
+	{
+		const SparseMasterEquation& W = Problem->masterEquation(time);
+		std::size_t version = Problem->masterEquationVersion();
+
+		if(!Factorisation.isFactorised() ||
+			version != FactorisedVersion ||
+			std::abs(c - FactorisedShift) > 1e-9*std::abs(c))
+		{
+			Factorisation.factorise(W,c);
+			FactorisedShift = c;
+			FactorisedVersion = version;
+			Factorisations++;
+		}
+
+		return FactorisedShift;
+	}
+
+	public:
+
+	ImplicitSolver(
+		std::vector<double> p_KeyFrameTime,
+		std::vector<double> p_initialOccupation,
+		QuantumSystem* p_problem
+	):
+		SingleStepODESolver(p_KeyFrameTime,p_initialOccupation,p_problem,nullptr)
+	{}
+
+	/**
+	* Returns how often the matrix was factorised.
+	*/
+	std::size_t factorisations()
+	{
+		return Factorisations;
+	}
+};
+
+/**
+* The backward euler scheme x_n+1 = x_n + h*W(t_n+1)*x_n+1 with a fixed
+* stepwidth. It is of first order only, but it damps the fast processes
+* instead of oscillating (L-stable), which makes it a robust choice for very
+* stiff systems. Every interval between two keyframes is split into steps of
+* equal width not larger than the given one, so with equidistant keyframes and
+* constant rates the matrix is factorised only once.
+*/
+class BackwardEulerSolver : public ImplicitSolver
+{
+	protected:
+
+	double MaximalStepWidth;
+
+	/**
+	* The width of the steps and the number of steps left until the next
+	* keyframe.
+	*/
+	double IntervalStepWidth = 0;
+	std::size_t StepsToKeyframe = 0;
+
+	arma::Col<double> Next;
+
+	double stepWidth() override
+	{
+		return IntervalStepWidth;
+	}
+
+	void advance() override
+	{
+		double remaining = KeyFrameTime.front()-CurrentTime;
+		if(remaining <= 0)
+		{
+			return;
+		}
+
+		if(StepsToKeyframe == 0)
+		{
+			StepsToKeyframe = std::max<std::size_t>(1,std::ceil(remaining/MaximalStepWidth - 1e-9));
+			IntervalStepWidth = remaining/StepsToKeyframe;
+		}
+
+		double time = CurrentTime + IntervalStepWidth;
+		factorise(time,IntervalStepWidth);
+
+		Factorisation.solve(CurrentValue,Next);
+		CurrentValue.swap(Next);
+
+		StepsToKeyframe--;
+		CurrentTime = StepsToKeyframe == 0 ? KeyFrameTime.front() : time;
+	}
+
+	public:
+
+	BackwardEulerSolver(
+		std::vector<double> p_KeyFrameTime,
+		std::vector<double> p_initialOccupation,
+		QuantumSystem* p_problem,
+		double p_StepWidth
+	):
+		ImplicitSolver(p_KeyFrameTime,p_initialOccupation,p_problem),
+		MaximalStepWidth(p_StepWidth)
+	{}
+};
+
+/**
+* An adaptive Rosenbrock-W scheme of second order (ROS2, Verwer et al. 1999)
+* for stiff systems:
+*
+*	(I - gamma*h*W) k1 = f(t_n,x_n)
+*	(I - gamma*h*W) k2 = f(t_n+h,x_n+h*k1) - 2*k1
+*	x_n+1 = x_n + 3/2*h*k1 + 1/2*h*k2
+*
+* with gamma = 1 + 1/sqrt(2). It is L-stable and needs no iteration, only two
+* solves with the same matrix per step. W is the matrix at t_n. Since it is a
+* W-method, the order is kept even if the rates change during the step. The
+* error is estimated with the first order solution x_n + h*k1 and controlled
+* like in the EmbeddedRungeKuttaSolver. To keep the factorisation, the
+* stepwidth is only increased if it can grow by at least GrowthThreshold. It
+* is decreased after a rejected step.
+*/
+class RosenbrockSolver : public ImplicitSolver
+{
+	protected:
+
+	const double Gamma = 1 + 1/std::sqrt(2.0);
+
+	double NextStepWidth;
+
+	/**
+	* The tolerated errors, see EmbeddedRungeKuttaSolver.
+	*/
+	double AbsoluteTolerance;
+	double RelativeTolerance;
+
+	double MaximalStepWidth;
+	double MinimalStepWidth;
+
+	bool MinimalStepWidthReached = false;
+
+	double Safety = 0.9;
+	double MinimalFactor = 0.2;
+	double MaximalFactor = 10;
+
+	/**
+	* The stepwidth is only increased if the controller allows at least this
+	* factor.
+	*/
+	double GrowthThreshold = 1.5;
+
+	std::size_t AcceptedSteps = 0;
+	std::size_t RejectedSteps = 0;
+
+	arma::Col<double> Derivative;
+	arma::Col<double> K1;
+	arma::Col<double> K2;
+	arma::Col<double> Proposal;
+
+	double stepWidth() override
+	{
+		return std::min(NextStepWidth,KeyFrameTime.front()-CurrentTime);
+	}
+
+	void advance() override
+	{
+		while(true)
+		{
+			double remaining = KeyFrameTime.front()-CurrentTime;
+			if(remaining <= 0)
+			{
+				return;
+			}
+
+			bool lastBeforeKeyframe = NextStepWidth >= remaining;
+			double h = factorise(CurrentTime,Gamma*(lastBeforeKeyframe ? remaining : NextStepWidth))/Gamma;
+
+			Problem->ODE(CurrentTime,CurrentValue,Derivative);
+			Factorisation.solve(Derivative,K1);
+
+			addScaled(CurrentValue,h,K1,Proposal);
+			Problem->ODE(CurrentTime+h,Proposal,Derivative);
+			for(arma::uword i = 0;i < Derivative.n_elem;i++)
+			{
+				Derivative(i) -= 2*K1(i);
+			}
+			Factorisation.solve(Derivative,K2);
+
+			//The error is the difference to the first order solution
+			//x_n + h*k1.
+			double sum = 0;
+			for(arma::uword i = 0;i < CurrentValue.n_elem;i++)
+			{
+				Proposal(i) = CurrentValue(i) + h*(1.5*K1(i) + 0.5*K2(i));
+
+				double scale = AbsoluteTolerance + RelativeTolerance*std::max(std::abs(CurrentValue(i)),std::abs(Proposal(i)));
+				double e = 0.5*h*(K1(i) + K2(i))/scale;
+				sum += e*e;
+			}
+			double err = CurrentValue.n_elem > 0 ? std::sqrt(sum/CurrentValue.n_elem) : 0;
+
+			double factor = err > 0 ? Safety/std::sqrt(err) : MaximalFactor;
+			factor = std::max(MinimalFactor,std::min(MaximalFactor,factor));
+
+			if(err <= 1 || h <= MinimalStepWidth)
+			{
+				if(err > 1)
+				{
+					MinimalStepWidthReached = true;
+				}
+
+				AcceptedSteps++;
+				CurrentValue.swap(Proposal);
+				CurrentTime = lastBeforeKeyframe ? KeyFrameTime.front() : CurrentTime+h;
+
+				if(!lastBeforeKeyframe && factor >= GrowthThreshold)
+				{
+					NextStepWidth = std::min(h*factor,MaximalStepWidth);
+				}
+
+				return;
+			}
+
+			RejectedSteps++;
+			NextStepWidth = std::max(h*factor,MinimalStepWidth);
+		}
+	}
+
+	public:
+
+	RosenbrockSolver(
+		std::vector<double> p_KeyFrameTime,
+		std::vector<double> p_initialOccupation,
+		QuantumSystem* p_problem,
+		double p_InitialStep,
+		double p_AbsoluteTolerance = 1e-10,
+		double p_RelativeTolerance = 1e-6,
+		double p_MaximalStepWidth = std::numeric_limits<double>::infinity(),
+		double p_MinimalStepWidth = 1e-15
+	):
+		ImplicitSolver(p_KeyFrameTime,p_initialOccupation,p_problem),
+		NextStepWidth(p_InitialStep),
+		AbsoluteTolerance(p_AbsoluteTolerance),
+		RelativeTolerance(p_RelativeTolerance),
+		MaximalStepWidth(p_MaximalStepWidth),
+		MinimalStepWidth(p_MinimalStepWidth)
+	{}
+
+	bool minimalStepWidthReached()
+	{
+		return MinimalStepWidthReached;
+	}
+
+	std::size_t acceptedSteps()
+	{
+		return AcceptedSteps;
+	}
+
+	std::size_t rejectedSteps()
+	{
+		return RejectedSteps;
+	}
+};
+
+/**
+* Solves masterequations whose rates are constant between switching times,
+* f.e. a bias that is held on plateaus, with the exact solution
+* p(t+dt) = exp(W*dt)*p(t) instead of integration steps. Every interval
+* between two keyframes is propagated in one step if the rates at its end are
+* the ones at its beginning. Otherwise the switching time is searched by
+* bisection up to SwitchResolution times the length of the interval, the
+* occupation is propagated to it exactly and the short step over the switch
+* uses the rates of its beginning. Rates that change continuously have a
+* switch in every step. They are refused with an exception, since the
+* solver would need an unbounded number of steps. Only the rates at the end
+* of a step are compared, so rates that change and change back within a step
+* are missed. The maximal stepwidth limits the steps for such rates.<br>
+* Systems with up to KrylovThreshold states use the dense propagator
+* exp(W*dt), calculated by armadillo with scaling and squaring. The
+* propagators are cached per stepwidth as long as the masterequation does not
+* change, so equally spaced keyframes cost one matrix-vector product each.
+* Larger systems only calculate the action of exp(W*dt) on the occupation in
+* a Krylov subspace of W, which needs only products of the sparse matrix with
+* a vector.
+*/
+class ExponentialSolver : public Solver
+{
+	protected:
+
+	double CurrentTime;
+
+	arma::Col<double> CurrentValue;
+	arma::Col<double> Next;
+
+	/**
+	* The maximal width of a propagation step. It is infinite unless the
+	* rates change and change back between the keyframes.
+	*/
+	double MaximalStepWidth;
+
+	/**
+	* The precision the switching times of the rates are searched with,
+	* relative to the length of the interval between two keyframes.
+	*/
+	double SwitchResolution;
+
+	/**
+	* The masterequation at the beginning of the current step. The
+	* propagators in the cache belong to it.
+	*/
+	SparseMasterEquation StepMatrix;
+
+	/**
+	* Systems with more states use the Krylov method.
+	*/
+	arma::uword KrylovThreshold;
+
+	/**
+	* The cached propagators by their stepwidth.
+	*/
+	std::map<double,arma::Mat<double>> Propagators;
+
+	/**
+	* The number of cached propagators. If it is reached, the cache is
+	* cleared, since the stepwidths are not equally spaced then anyway.
+	*/
+	std::size_t MaximalCachedPropagators = 8;
+
+	std::size_t MatrixExponentials = 0;
+
+	/**
+	* The dimension of the Krylov subspace, the tolerated error of the
+	* Krylov method per propagation and the width of its last substep.
+	*/
+	arma::uword KrylovDimension = 30;
+	double Tolerance;
+	double KrylovStepWidth = 0;
+
+	std::size_t KrylovSteps = 0;
+
+	std::size_t Switches = 0;
+
+	/**
+	* The orthonormal basis of the Krylov subspace and the projection of W
+	* on it.
+	*/
+	std::vector<arma::Col<double>> Basis;
+	arma::Mat<double> Hessenberg;
+
+	std::vector<double> Moment;
+
+	/**
+	* Returns exp(W*h) from the cache or calculates it.
+	*/
+	const arma::Mat<double>& propagator(const SparseMasterEquation& W,double h)
+	{
+		//Stepwidths that only differ by rounding errors share the propagator.
+		auto cached = Propagators.lower_bound(h*(1-1e-12));
+		if(cached != Propagators.end() && cached->first <= h*(1+1e-12))
+		{
+			return cached->second;
+		}
+
+		if(Propagators.size() >= MaximalCachedPropagators)
+		{
+			Propagators.clear();
+		}
+
+		MatrixExponentials++;
+		return Propagators.emplace(h,arma::expmat(W.asMat()*h)).first->second;
+	}
+
+	/**
+	* Replaces p by exp(W*h)*p. The interval is split into substeps, each of
+	* them is calculated in a Krylov subspace of the dimension
+	* KrylovDimension (Saad 1992, Sidje 1998). Substeps whose estimated error
+	* exceeds their share of Tolerance are repeated with a smaller width.
+	*/
+	void krylovPropagate(const SparseMasterEquation& W,double h,arma::Col<double>& p)
+	{
+		arma::uword n = p.n_elem;
+		arma::uword m = std::min(KrylovDimension,n);
+
+		//The basis vectors are normalised, so the breakdown of the Arnoldi
+		//iteration is measured relative to the norm of W.
+		double breakdown = 1e-12*W.maximalEscapeRate();
+
+		if(Basis.size() != m+1 || Basis.front().n_elem != n)
+		{
+			Basis.assign(m+1,arma::Col<double>(n,arma::fill::zeros));
+		}
+
+		double t = 0;
+		double tau = KrylovStepWidth > 0 ? std::min(KrylovStepWidth,h) : h;
+
+		while(t < h)
+		{
+			double beta = 0;
+			for(arma::uword i = 0;i < n;i++)
+			{
+				beta += p(i)*p(i);
+			}
+			beta = std::sqrt(beta);
+
+			if(beta == 0)
+			{
+				return;
+			}
+
+			for(arma::uword i = 0;i < n;i++)
+			{
+				Basis[0](i) = p(i)/beta;
+			}
+
+			//Arnoldi iteration with modified Gram-Schmidt.
+			Hessenberg.zeros(m+1,m);
+			arma::uword k = m;
+			bool invariant = false;
+
+			for(arma::uword j = 0;j < m;j++)
+			{
+				arma::Col<double>& w = Basis[j+1];
+				W.multiply(Basis[j],w);
+
+				for(arma::uword i = 0;i <= j;i++)
+				{
+					double projection = 0;
+					for(arma::uword l = 0;l < n;l++)
+					{
+						projection += Basis[i](l)*w(l);
+					}
+
+					Hessenberg(i,j) = projection;
+					for(arma::uword l = 0;l < n;l++)
+					{
+						w(l) -= projection*Basis[i](l);
+					}
+				}
+
+				double s = 0;
+				for(arma::uword l = 0;l < n;l++)
+				{
+					s += w(l)*w(l);
+				}
+				s = std::sqrt(s);
+				Hessenberg(j+1,j) = s;
+
+				//The subspace is invariant under W, the result is exact.
+				if(s <= breakdown)
+				{
+					k = j+1;
+					invariant = true;
+					break;
+				}
+
+				for(arma::uword l = 0;l < n;l++)
+				{
+					w(l) /= s;
+				}
+			}
+
+			if(invariant)
+			{
+				tau = h-t;
+			}
+
+			//The exponential of the augmented matrix [H e_1; 0 0] holds
+			//exp(H)*e_1 in its first column and phi_1(H)*e_1 in its last one,
+			//with phi_1(z) = (exp(z)-1)/z.
+			arma::Mat<double> H(k+1,k+1,arma::fill::zeros);
+			for(arma::uword j = 0;j < k;j++)
+			{
+				for(arma::uword i = 0;i < k;i++)
+				{
+					H(i,j) = Hessenberg(i,j);
+				}
+			}
+
+			while(true)
+			{
+				tau = std::min(tau,h-t);
+
+				arma::Mat<double> augmented = H*tau;
+				augmented(0,k) = 1;
+				arma::Mat<double> E = arma::expmat(augmented);
+
+				//The norm of the residual of the Krylov approximation,
+				//beta*h_{k+1,k}*tau*|e_k^T phi_1(tau*H) e_1|, as error estimate.
+				double error = invariant ? 0 : beta*Hessenberg(k,k-1)*tau*std::abs(E(k-1,k));
+				double tolerated = Tolerance*tau/h;
+
+				if(error <= tolerated || tau <= 1e-12*h)
+				{
+					p.zeros();
+					for(arma::uword i = 0;i < k;i++)
+					{
+						double c = beta*E(i,0);
+						for(arma::uword l = 0;l < n;l++)
+						{
+							p(l) += c*Basis[i](l);
+						}
+					}
+
+					t = tau >= h-t ? h : t+tau;
+					KrylovSteps++;
+
+					double factor = error > 0 ? 0.9*std::pow(tolerated/error,1.0/k) : 5;
+					KrylovStepWidth = tau*std::max(0.2,std::min(5.0,factor));
+					tau = KrylovStepWidth;
+					break;
+				}
+
+				tau *= std::max(0.2,0.9*std::pow(tolerated/error,1.0/k));
+			}
+		}
+	}
+
+	/**
+	* Searches the switch of the rates between CurrentTime and end by
+	* bisection, until it is enclosed within the resolution.
+	*
+	* @param constantUntil Is set to the latest time found at which the rates
+	* are still the ones of StepMatrix.
+	* @return The earliest time found at which the rates differ.
+	*/
+	double findSwitch(double end,double resolution,double& constantUntil)
+	{
+		constantUntil = CurrentTime;
+
+		while(end-constantUntil > resolution)
+		{
+			double middle = 0.5*(constantUntil+end);
+
+			//The times are not resolved any finer.
+			if(middle <= constantUntil || middle >= end)
+			{
+				break;
+			}
+
+			if(Problem->masterEquation(middle) == StepMatrix)
+			{
+				constantUntil = middle;
+			}
+			else
+			{
+				end = middle;
+			}
+		}
+
+		return end;
+	}
+
+	/**
+	* Propagates CurrentValue to the given keyframe. Every step starts with
+	* the rates at its beginning and ends at the keyframe, at the maximal
+	* stepwidth or at the next switch of the rates.
+	*/
+	void propagateTo(double keyframe)
+	{
+		double resolution = SwitchResolution*(keyframe-CurrentTime);
+		bool previousStepSwitched = false;
+
+		while(CurrentTime < keyframe)
+		{
+			const SparseMasterEquation& W = Problem->masterEquation(CurrentTime);
+
+			if(W != StepMatrix)
+			{
+				StepMatrix = W;
+				Propagators.clear();
+			}
+
+			double end = std::min(keyframe,CurrentTime+MaximalStepWidth);
+			bool switched = false;
+
+			if(Problem->masterEquation(end) != StepMatrix)
+			{
+				double constantUntil;
+				double switchTime = findSwitch(end,resolution,constantUntil);
+
+				if(constantUntil > CurrentTime)
+				{
+					//The rates are constant up to the switch.
+					end = constantUntil;
+				}
+				else
+				{
+					//The step over the switch is not longer than the
+					//resolution and uses the rates of its beginning.
+					if(previousStepSwitched)
+					{
+						throw std::runtime_error("The rates of the masterequation change continuously. The ExponentialSolver needs rates that are constant between switching times.");
+					}
+
+					end = switchTime;
+					switched = true;
+					Switches++;
+				}
+			}
+
+			previousStepSwitched = switched;
+			double h = end-CurrentTime;
+
+			if(StepMatrix.dimension() > KrylovThreshold)
+			{
+				krylovPropagate(StepMatrix,h,CurrentValue);
+			}
+			else
+			{
+				Next = propagator(StepMatrix,h)*CurrentValue;
+				CurrentValue.swap(Next);
+			}
+
+			CurrentTime = end;
+		}
+	}
+
+	public:
+
+	ExponentialSolver(
+		std::vector<double> p_KeyFrameTime,
+		std::vector<double> p_initialOccupation,
+		QuantumSystem* p_problem,
+		double p_MaximalStepWidth = std::numeric_limits<double>::infinity(),
+		arma::uword p_KrylovThreshold = 1000,
+		double p_Tolerance = 1e-10,
+		double p_SwitchResolution = 1e-9
+	):
+		Solver(p_KeyFrameTime,p_initialOccupation,p_problem),
+		CurrentTime(p_KeyFrameTime.front()),
+		CurrentValue(arma::vec(p_initialOccupation.size(),arma::fill::zeros)),
+		MaximalStepWidth(p_MaximalStepWidth),
+		SwitchResolution(p_SwitchResolution),
+		KrylovThreshold(p_KrylovThreshold),
+		Tolerance(p_Tolerance)
+	{
+		for(int i=0;i<p_initialOccupation.size();i++)
+		{
+			CurrentValue(i) = p_initialOccupation[i];
+		}
+	}
+
+	void solve() override
+	{
+		while(!KeyFrameTime.empty())
+		{
+			propagateTo(KeyFrameTime.front());
+
+			Moment.assign(CurrentValue.memptr(),CurrentValue.memptr()+Problem->numberOfStates());
+
+			Problem->logMoment(CurrentTime,Moment);
+			KeyFrameTime.erase(KeyFrameTime.begin());
+		}
+	}
+
+	/**
+	* Returns how often a dense propagator was calculated.
+	*/
+	std::size_t matrixExponentials()
+	{
+		return MatrixExponentials;
+	}
+
+	/**
+	* Returns the number of substeps of the Krylov method.
+	*/
+	std::size_t krylovSteps()
+	{
+		return KrylovSteps;
+	}
+
+	/**
+	* Returns the number of switches of the rates that were stepped over.
+	*/
+	std::size_t switches()
+	{
+		return Switches;
+	}
+};
+
+/**
+* Calculates the stationary occupation, i.e. the solution of W*p = 0 with
+* sum(p) = 1, directly instead of integrating until the transients died out.
+* It is meant for DC measurements, where only the occupation after a long time
+* matters. On every keyframe the stationary occupation for the rates at its
+* time is logged. It is only solved again if the masterequation changed.<br>
+* Systems that conserve a quantity have more than one closed class of states
+* (see SparseMasterEquation::closedClasses) and therefore more than one
+* stationary distribution. The solver then returns the one the initial
+* occupation converges to: every closed class gets its stationary distribution
+* weighted with the occupation that ends up in it, including the occupation
+* that flows into it from the transient states.<br>
+* Classes with up to DenseThreshold states are solved with a dense LU
+* decomposition, larger ones with the sparse solver of armadillo.
+*/
+class SteadyStateSolver : public Solver
+{
+	protected:
+
+	arma::Col<double> InitialValue;
+	arma::Col<double> Stationary;
+
+	arma::uword DenseThreshold;
+
+	/**
+	* The version of the masterequation Stationary belongs to, see
+	* QuantumSystem::masterEquationVersion.
+	*/
+	bool Solved = false;
+	std::size_t SolvedVersion = 0;
+
+	std::size_t ClosedClasses = 0;
+
+	std::vector<double> Moment;
+
+	/**
+	* Solves the linear system of the submatrix of the given states. See
+	* SparseMasterEquation::asSpMat.
+	*/
+	arma::Col<double> solveSubsystem(const SparseMasterEquation& W,const std::vector<arma::uword>& states,bool normalised,const arma::Col<double>& rightHandSide)
+	{
+		arma::Col<double> toReturn;
+		bool solved;
+
+		if(states.size() <= DenseThreshold)
+		{
+			solved = arma::solve(toReturn,W.asMat(states,normalised),rightHandSide);
+		}
+		else
+		{
+			solved = arma::spsolve(toReturn,W.asSpMat(states,normalised),rightHandSide);
+		}
+
+		if(!solved)
+		{
+			throw std::runtime_error("The stationary occupation could not be calculated, the masterequation is singular.");
+		}
+
+		return toReturn;
+	}
+
+	/**
+	* Calculates Stationary for the masterequation at the given time.
+	*/
+	void solveStationary(double time)
+	{
+		const SparseMasterEquation& W = Problem->masterEquation(time);
+
+		if(Solved && Problem->masterEquationVersion() == SolvedVersion)
+		{
+			return;
+		}
+
+		arma::uword n = W.dimension();
+		std::vector<std::vector<arma::uword>> classes = W.closedClasses();
+		ClosedClasses = classes.size();
+
+		//The occupation that ends up in every state of a closed class. If
+		//there is only one class, everything ends up in it.
+		arma::Col<double> absorbed(n,arma::fill::zeros);
+
+		if(classes.size() > 1)
+		{
+			for(arma::uword i = 0;i < InitialValue.n_elem && i < n;i++)
+			{
+				absorbed(i) = InitialValue(i);
+			}
+
+			std::vector<bool> closed(n,false);
+			for(auto& c : classes)
+			{
+				for(arma::uword i : c)
+				{
+					closed[i] = true;
+				}
+			}
+
+			std::vector<arma::uword> transient;
+			for(arma::uword i = 0;i < n;i++)
+			{
+				if(!closed[i])
+				{
+					transient.push_back(i);
+				}
+			}
+
+			//The time integral of the transient occupation y solves
+			//W_TT*y = -p_T(0). The flow W*y carries it into the classes.
+			if(!transient.empty())
+			{
+				arma::Col<double> rightHandSide(transient.size(),arma::fill::zeros);
+				for(arma::uword i = 0;i < transient.size();i++)
+				{
+					rightHandSide(i) = -absorbed(transient[i]);
+				}
+
+				arma::Col<double> integral = solveSubsystem(W,transient,false,rightHandSide);
+
+				arma::Col<double> y(n,arma::fill::zeros);
+				for(arma::uword i = 0;i < transient.size();i++)
+				{
+					y(transient[i]) = integral(i);
+				}
+
+				arma::Col<double> flow;
+				W.multiply(y,flow);
+				for(arma::uword i = 0;i < n;i++)
+				{
+					absorbed(i) += flow(i);
+				}
+			}
+		}
+
+		double total = 0;
+		std::vector<double> weights;
+		for(auto& c : classes)
+		{
+			double weight = classes.size() == 1 ? 1 : 0;
+			for(arma::uword i : c)
+			{
+				weight += absorbed(i);
+			}
+
+			weights.push_back(weight);
+			total += weight;
+		}
+
+		if(!(total > 0))
+		{
+			throw std::runtime_error("The masterequation has " + std::to_string(classes.size()) + " stationary distributions and the initial occupation selects none of them.");
+		}
+
+		Stationary.zeros(n);
+
+		for(std::size_t c = 0;c < classes.size();c++)
+		{
+			if(weights[c] <= 0)
+			{
+				continue;
+			}
+
+			arma::Col<double> rightHandSide(classes[c].size(),arma::fill::zeros);
+			rightHandSide(0) = 1;
+
+			arma::Col<double> distribution = solveSubsystem(W,classes[c],true,rightHandSide);
+
+			for(arma::uword i = 0;i < classes[c].size();i++)
+			{
+				Stationary(classes[c][i]) = weights[c]/total*distribution(i);
+			}
+		}
+
+		Solved = true;
+		SolvedVersion = Problem->masterEquationVersion();
+	}
+
+	public:
+
+	SteadyStateSolver(
+		std::vector<double> p_KeyFrameTime,
+		std::vector<double> p_initialOccupation,
+		QuantumSystem* p_problem,
+		arma::uword p_DenseThreshold = 1000
+	):
+		Solver(p_KeyFrameTime,p_initialOccupation,p_problem),
+		InitialValue(arma::vec(p_initialOccupation.size(),arma::fill::zeros)),
+		DenseThreshold(p_DenseThreshold)
+	{
+		for(int i=0;i<p_initialOccupation.size();i++)
+		{
+			InitialValue(i) = p_initialOccupation[i];
+		}
+	}
+
+	void solve() override
+	{
+		while(!KeyFrameTime.empty())
+		{
+			double time = KeyFrameTime.front();
+			solveStationary(time);
+
+			Moment.assign(Stationary.memptr(),Stationary.memptr()+Problem->numberOfStates());
+
+			Problem->logMoment(time,Moment);
+			KeyFrameTime.erase(KeyFrameTime.begin());
+		}
+	}
+
+	/**
+	* Returns the number of closed classes of the last solved
+	* masterequation. If it is larger than one, the stationary occupation
+	* depends on the initial occupation.
+	*/
+	std::size_t closedClasses()
+	{
+		return ClosedClasses;
+	}
+};
+
+/**
+* This solver splits the system into its invariant sectors (see
+* QuantumSystem::invariantSectors) and integrates every sector as a problem of
+* its own. The sectors are distributed over a number of threads, which are
+* started once per solve. On every keyframe the results of the sectors are
+* merged back into one occupation vector and logged. If the system conserves a
+* quantity, the cost of a step is the sum over the much smaller sectors instead
+* of the whole system.<br>
+* Every sector is integrated by a SingleStepODESolver of its own, so each
+* sector can f.e. choose its own stepwidth with the EmbeddedRungeKuttaSolver.
+* By default the sectors are integrated with a fixed stepwidth, and the last
+* step before a keyframe is shortened so that every keyframe is hit exactly.<br>
+* The rates are updated edge by edge, batched updates of edge groups (see
+* QuantumSystem::updateEdgeGroup) are bypassed, since a group spans all
+* sectors and the sectors run in parallel. With more than one thread,
+* Edge::update, actualisationNeedet and createEdges of the system are called
+* for different sectors at the same time, so they must only read shared data.
+*/
+class SectorSolver : public Solver
+{
+	public:
+
+	/**
+	* Creates the solver of one sector from the keyframes, the initial
+	* occupation of the sector and the system. The keyframes are the ones
+	* that are left when the sectors are created.
+	*/
+	typedef std::function<SingleStepODESolver*(std::vector<double>,std::vector<double>,QuantumSystem*)> SectorSolverFactory;
+
+	protected:
+
+	/**
+	* Integrates a sector with a fixed stepwidth. The last step before a
+	* keyframe is shortened.
+	*/
+	class FixedSteps : public SingleStepODESolver
+	{
+		protected:
+
+		double StepWidth;
+
+		double stepWidth() override
+		{
+			return std::min(StepWidth,KeyFrameTime.front()-CurrentTime);
+		}
+
+		public:
+
+		FixedSteps(
+			std::vector<double> p_KeyFrameTime,
+			std::vector<double> p_initialOccupation,
+			QuantumSystem* p_problem,
+			SingleStepScheme* p_Scheme,
+			double p_StepWidth
+		):
+			SingleStepODESolver(p_KeyFrameTime,p_initialOccupation,p_problem,p_Scheme),
+			StepWidth(p_StepWidth)
+		{}
+	};
+
+	SectorSolverFactory Factory;
+
+	/**
+	* The number of threads the sectors are distributed on.
+	*/
+	int ThreadCount;
+
+	/**
+	* The occupation of all states at CurrentTime.
+	*/
+	std::vector<double> CurrentOccupation;
+
+	/**
+	* The current in simulation time.
+	*/
+	double CurrentTime;
+
+	/**
+	* Integrates the sector to the next keyframe with its solver and writes
+	* the result to CurrentOccupation.
+	*/
+	void integrateSector(QuantumSystem::Sector& sector,SingleStepODESolver& solver)
+	{
+		const std::vector<std::size_t>& states = sector.states();
+		const arma::Col<double>& x = solver.integrateToNextKeyframe();
+
+		for(std::size_t k = 0;k < states.size();k++)
+		{
+			CurrentOccupation[states[k]] = x(k);
+		}
+	}
+
+	public:
+
+	/**
+	* Integrates every sector with the given scheme and a fixed stepwidth.
+	*/
+	SectorSolver(
+		std::vector<double> p_KeyFrameTime,
+		std::vector<double> p_initialOccupation,
+		QuantumSystem* p_problem,
+		SingleStepScheme* p_Scheme,
+		double p_StepWidth,
+		int p_ThreadCount = 1
+	):
+		SectorSolver(
+			p_KeyFrameTime,
+			p_initialOccupation,
+			p_problem,
+			[p_Scheme,p_StepWidth](std::vector<double> keyframes,std::vector<double> occupation,QuantumSystem* problem) -> SingleStepODESolver*
+			{
+				return new FixedSteps(keyframes,occupation,problem,p_Scheme,p_StepWidth);
+			},
+			p_ThreadCount
+		)
+	{}
+
+	/**
+	* Integrates every sector with a solver created by the factory, f.e.
+	*
+	*	[&scheme](std::vector<double> k,std::vector<double> o,QuantumSystem* p)
+	*	{
+	*		return new EmbeddedRungeKuttaSolver(k,o,p,&scheme,1e-3);
+	*	}
+	*/
+	SectorSolver(
+		std::vector<double> p_KeyFrameTime,
+		std::vector<double> p_initialOccupation,
+		QuantumSystem* p_problem,
+		SectorSolverFactory p_Factory,
+		int p_ThreadCount = 1
+	):
+		Solver(p_KeyFrameTime,p_initialOccupation,p_problem),
+		Factory(p_Factory),
+		ThreadCount(p_ThreadCount),
+		CurrentOccupation(p_initialOccupation),
+		CurrentTime(p_KeyFrameTime.front())
+	{}
+
+	void solve() override
+	{
+		std::vector<QuantumSystem::Sector> sectors = Problem->invariantSectors(CurrentTime);
+
+		//A sector with one state has no dynamics.
+		std::vector<QuantumSystem::Sector*> active;
+		std::vector<std::unique_ptr<SingleStepODESolver>> solvers;
+
+		for(QuantumSystem::Sector& sector : sectors)
+		{
+			if(sector.states().size() > 1)
+			{
+				std::vector<double> occupation;
+				for(std::size_t n : sector.states())
+				{
+					occupation.push_back(CurrentOccupation[n]);
+				}
+
+				active.push_back(&sector);
+				solvers.emplace_back(Factory(KeyFrameTime,occupation,Problem));
+				solvers.back()->useEquation(&sector);
+			}
+		}
+
+		//The threads wait for the next keyframe between the rounds. A round
+		//integrates every sector to the keyframe.
+		std::mutex roundMutex;
+		std::condition_variable roundStarted;
+		std::condition_variable roundFinished;
+		std::size_t round = 0;
+		int busyThreads = 0;
+		bool finished = false;
+		std::exception_ptr error;
+		std::atomic<std::size_t> nextSector(0);
+
+		auto work = [&]()
+		{
+			try
+			{
+				for(std::size_t i = nextSector++;i < active.size();i = nextSector++)
+				{
+					integrateSector(*active[i],*solvers[i]);
+				}
+			}
+			catch(...)
+			{
+				std::lock_guard<std::mutex> guard(roundMutex);
+				if(!error)
+				{
+					error = std::current_exception();
+				}
+			}
+		};
+
+		auto helper = [&]()
+		{
+			std::size_t seenRound = 0;
+
+			while(true)
+			{
+				{
+					std::unique_lock<std::mutex> lock(roundMutex);
+					roundStarted.wait(lock,[&](){return finished || round != seenRound;});
+
+					if(finished)
+					{
+						return;
+					}
+
+					seenRound = round;
+				}
+
+				work();
+
+				std::lock_guard<std::mutex> guard(roundMutex);
+				busyThreads--;
+				roundFinished.notify_all();
+			}
+		};
+
+		std::vector<std::thread> threads;
+		for(int i = 1;i < ThreadCount;i++)
+		{
+			threads.push_back(std::thread(helper));
+		}
+
+		while(!KeyFrameTime.empty() && !error)
+		{
+			{
+				std::lock_guard<std::mutex> guard(roundMutex);
+				nextSector = 0;
+				busyThreads = (int)threads.size();
+				round++;
+			}
+			roundStarted.notify_all();
+
+			work();
+
+			{
+				std::unique_lock<std::mutex> lock(roundMutex);
+				roundFinished.wait(lock,[&](){return busyThreads == 0;});
+			}
+
+			if(error)
+			{
+				break;
+			}
+
+			CurrentTime = KeyFrameTime.front();
+
+			Problem->logMoment(CurrentTime,CurrentOccupation);
+			KeyFrameTime.erase(KeyFrameTime.begin());
+		}
+
+		{
+			std::lock_guard<std::mutex> guard(roundMutex);
+			finished = true;
+		}
+		roundStarted.notify_all();
+
+		for(std::thread& t : threads)
+		{
+			t.join();
+		}
+
+		if(error)
+		{
+			std::rethrow_exception(error);
+		}
+	}
+};
@@ -1,142 +1,880 @@
 
 #include <queue>
+#include <deque>
+#include <limits>
 #include <thread>
 #include <chrono>
 #include <mutex>
+#include <memory>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <exception>
+#include <atomic>
+#include <algorithm>
+#include <cstdlib>
+#include <cmath>
+#include <cstdio>
+#include <set>
 
-/**
-* This is the Mutex that is used to coordinate the access on shared memory used
-* by the workerthreads and the coordination thread.
-*/
-std::mutex commonMutex;
+#if defined(__unix__) || defined(__APPLE__)
+#include <unistd.h>
+#endif
 
 /**
-* Systems that are not simulated and their corresponding solvers are stored in
-* this queue to be processed by the workerthreads.
+* A queue that many threads can push to and pop from at the same time. Threads
+* that pop from an empty queue sleep until there is an element, threads that
+* push to a full queue sleep until there is space. After shutdown, the
+* remaining elements can still be popped, afterwards pop returns false at once,
+* so the threads that wait for elements can end.
 */
-std::queue<std::pair<QuantumSystem*,Solver*>> WorkSource;
+template<class T>
+class BlockingQueue
+{
+	protected:
 
-/**
-* Multithreading in this program works as follows: The Thread that was created
-* to run the main method manages the work that is done by any number of worker
-* threads. The coordination of the work is done using shared memory. The Shared
-* memory consists of a queue that contains the quantumsystems that should be
-* simulated and the solver that should be used and a boolean that indicates if
-* there is more work to come or not. The workerthreads source work from the
-* queue if the queue is not empty. If it is empty the workerthreads wait until
-* the boolean that indicates whether there is work to come or not turns false.
-* The workerthreads process the system and save the data as .graphml. Additional
-* information is saved in a METADATA.csv file.
-* This Boolean indicates if the system should continue to run and wait for work
-* or if it should stop.
-*/	
-bool Running=true;
+	std::mutex Mutex;
 
-/**
-* This method provides access to the Running variable.
-*/
-bool shouldContinue()
-{
-	std::lock_guard<std::mutex> guard(commonMutex);
-	return Running;
-}
+	/**
+	* Signals that an element was pushed or that the queue was shut down.
+	*/
+	std::condition_variable Pushed;
 
-/**
-* This method returns the number of pending jobs stored in WorkSource.
-*/
-int jobsInPendingQueue()
-{
-	std::lock_guard<std::mutex> guard(commonMutex);
-	return WorkSource.size(); 
-}
+	/**
+	* Signals that an element was popped or that the queue was shut down.
+	*/
+	std::condition_variable Popped;
+
+	std::deque<T> Elements;
+
+	std::size_t Capacity;
+
+	bool IsShutdown = false;
+
+	public:
+
+	/**
+	* @param capacity The maximal number of elements in the queue.
+	*/
+	BlockingQueue(std::size_t capacity = std::numeric_limits<std::size_t>::max()):
+		Capacity(capacity > 0 ? capacity : 1)
+	{}
+
+	void setCapacity(std::size_t capacity)
+	{
+		{
+			std::lock_guard<std::mutex> guard(Mutex);
+			Capacity = capacity > 0 ? capacity : 1;
+		}
+		Popped.notify_all();
+	}
+
+	/**
+	* Appends an element. It blocks while the queue is full.
+	*
+	* @return false if the queue was shut down. The element is not appended
+	* then.
+	*/
+	bool push(T element)
+	{
+		{
+			std::unique_lock<std::mutex> lock(Mutex);
+			Popped.wait(lock,[this](){return Elements.size() < Capacity || IsShutdown;});
+
+			if(IsShutdown)
+			{
+				return false;
+			}
+
+			Elements.push_back(std::move(element));
+		}
+		Pushed.notify_one();
+
+		return true;
+	}
+
+	/**
+	* Removes the first element. It blocks while the queue is empty and not
+	* shut down.
+	*
+	* @return false if the queue is shut down and empty.
+	*/
+	bool pop(T& element)
+	{
+		{
+			std::unique_lock<std::mutex> lock(Mutex);
+			Pushed.wait(lock,[this](){return !Elements.empty() || IsShutdown;});
+
+			if(Elements.empty())
+			{
+				return false;
+			}
+
+			element = std::move(Elements.front());
+			Elements.pop_front();
+		}
+		Popped.notify_all();
+
+		return true;
+	}
+
+	/**
+	* Wakes up all waiting threads. No elements can be pushed afterwards.
+	*/
+	void shutdown()
+	{
+		{
+			std::lock_guard<std::mutex> guard(Mutex);
+			IsShutdown = true;
+		}
+		Pushed.notify_all();
+		Popped.notify_all();
+	}
+
+	/**
+	* Makes the queue usable again after shutdown.
+	*/
+	void reopen()
+	{
+		std::lock_guard<std::mutex> guard(Mutex);
+		IsShutdown = false;
+	}
+
+	std::size_t size()
+	{
+		std::lock_guard<std::mutex> guard(Mutex);
+		return Elements.size();
+	}
+};
 
 /**
-* This Method asks if there are unprocessed systems in the WorkSource queue. It
-* is used by the Workerthreads to source new Work.
+* A set of long-lived workerthreads that process jobs. A job is any function
+* without parameters. The pool is not bound to an experiment: several
+* experiments can share one pool, also at the same time, so the threads are
+* only created once in programs that conduct many small experiments. Every
+* experiment keeps track of its own jobs (see Experiment).<br>
+* Every workerthread has a queue of its own. The jobs in a queue are sorted by
+* their estimated cost, the most expensive first, so that long jobs are not
+* started at the end, when the other threads are already idle. A thread takes
+* the jobs of its own queue. Only if it is empty, the thread steals the first
+* job of another queue.
 */
-bool thereIsJob()
+class WorkerPool
 {
-	std::lock_guard<std::mutex> guard(commonMutex);
-	return !WorkSource.empty(); 
-}
+	protected:
+
+	struct Job
+	{
+		double Cost;
+		std::function<void()> Run;
+	};
+
+	struct WorkerQueue
+	{
+		std::mutex Mutex;
+
+		/**
+		* The jobs of the thread, the most expensive first.
+		*/
+		std::deque<Job> Jobs;
+	};
+
+	std::vector<std::unique_ptr<WorkerQueue>> Queues;
+
+	/**
+	* Guards Pending, Submitted and IsShutdown. Idle threads sleep on
+	* JobAvailable, threads that missed their claimed job on JobSubmitted.
+	* Both are notified by submit.
+	*/
+	std::mutex SleepMutex;
+	std::condition_variable JobAvailable;
+	std::condition_variable JobSubmitted;
+
+	/**
+	* The number of jobs in the queues that no thread has claimed yet.
+	*/
+	std::size_t Pending = 0;
+
+	/**
+	* The number of jobs submitted so far.
+	*/
+	std::size_t Submitted = 0;
+
+	bool IsShutdown = false;
+
+	/**
+	* The queue the next job is submitted to.
+	*/
+	std::atomic<std::size_t> NextQueue{0};
+
+	std::vector<std::thread> Workers;
+
+	/**
+	* Takes the first job of a queue.
+	*/
+	bool take(std::size_t queue,Job& job)
+	{
+		std::lock_guard<std::mutex> guard(Queues[queue]->Mutex);
+
+		if(Queues[queue]->Jobs.empty())
+		{
+			return false;
+		}
+
+		job = std::move(Queues[queue]->Jobs.front());
+		Queues[queue]->Jobs.pop_front();
+
+		return true;
+	}
+
+	/**
+	* Takes the first job of the own queue of the thread. Only if it is
+	* empty, the other queues are searched, starting with the next one.
+	*/
+	bool takeJob(std::size_t self,Job& job)
+	{
+		for(std::size_t i = 0;i < Queues.size();i++)
+		{
+			if(take((self + i) % Queues.size(),job))
+			{
+				return true;
+			}
+		}
+
+		return false;
+	}
+
+	/**
+	* This Method is executed by the workerthreads and defines their
+	* behaviour. They process jobs until the pool is destroyed.
+	*/
+	void work(std::size_t self)
+	{
+		while(true)
+		{
+			std::size_t submitted;
+			{
+				std::unique_lock<std::mutex> lock(SleepMutex);
+				JobAvailable.wait(lock,[this](){return Pending > 0 || IsShutdown;});
+
+				if(Pending == 0)
+				{
+					return;
+				}
+
+				//Claims one of the jobs in the queues.
+				Pending--;
+				submitted = Submitted;
+			}
+
+			//There is at least one job for every claim. The search can only
+			//miss it if a job was submitted to a queue that was already
+			//searched while another thread took the job that was left. Then
+			//the thread sleeps until that submission is completed.
+			Job job;
+			while(!takeJob(self,job))
+			{
+				std::unique_lock<std::mutex> lock(SleepMutex);
+				JobSubmitted.wait(lock,[this,submitted](){return Submitted != submitted;});
+				submitted = Submitted;
+			}
+
+			job.Run();
+		}
+	}
+
+	public:
+
+	WorkerPool(int workerCount)
+	{
+		for(int i = 0;i < workerCount;i++)
+		{
+			Queues.push_back(std::unique_ptr<WorkerQueue>(new WorkerQueue()));
+		}
+
+		for(int i = 0;i < workerCount;i++)
+		{
+			Workers.push_back(std::thread(&WorkerPool::work,this,(std::size_t)i));
+		}
+	}
+
+	/**
+	* Lets the workerthreads finish all submitted jobs and joins them.
+	*/
+	~WorkerPool()
+	{
+		{
+			std::lock_guard<std::mutex> guard(SleepMutex);
+			IsShutdown = true;
+		}
+		JobAvailable.notify_all();
+
+		for(std::thread& t : Workers)
+		{
+			t.join();
+		}
+	}
+
+	WorkerPool(const WorkerPool&) = delete;
+	WorkerPool& operator=(const WorkerPool&) = delete;
+
+	/**
+	* Hands a job to the pool. The jobs are distributed over the queues of
+	* the threads in turn.
+	*
+	* @param cost An estimate of the time the job takes, f.e. in seconds. Of
+	* the jobs that wait, the most expensive ones are started first. Jobs
+	* with the same cost are started in the order they were submitted.
+	*/
+	void submit(std::function<void()> job,double cost = 0)
+	{
+		WorkerQueue& queue = *Queues[NextQueue++ % Queues.size()];
+
+		{
+			std::lock_guard<std::mutex> guard(queue.Mutex);
+
+			auto position = std::find_if(queue.Jobs.begin(),queue.Jobs.end(),[cost](const Job& j){return j.Cost < cost;});
+			queue.Jobs.insert(position,Job{cost,std::move(job)});
+		}
+
+		{
+			std::lock_guard<std::mutex> guard(SleepMutex);
+			Pending++;
+			Submitted++;
+		}
+		JobAvailable.notify_one();
+		JobSubmitted.notify_all();
+	}
+
+	int workerCount()
+	{
+		return Workers.size();
+	}
+
+	/**
+	* Returns the number of jobs of all experiments that were not started yet.
+	*/
+	std::size_t pendingJobs()
+	{
+		std::lock_guard<std::mutex> guard(SleepMutex);
+		return Pending;
+	}
+};
 
 /**
-* This Mehthod sets the variable that tells the workerthreads that there is
-* more work to come to true. It is used to start the workerthreads. This is only
-* important, when one program is running multible experiments.
+* Estimates the time it takes to solve a measurement from the times of the
+* measurements that were solved before. The estimate is the time of the
+* solved measurement whose attributes are the closest. Attributes that are
+* numbers are compared relative to the range of the values seen so far, the
+* other ones are either equal or not. Only the latest measurements are kept,
+* so estimating stays cheap in large sweeps.
 */
-void startWork()
+class CostEstimator
 {
-	std::lock_guard<std::mutex> guard(commonMutex);
-	Running = true;
-}
+	protected:
+
+	struct Observation
+	{
+		std::vector<std::string> Attributes;
+
+		/**
+		* The attributes as numbers, NaN for the ones that are no numbers.
+		*/
+		std::vector<double> Values;
+
+		double Seconds;
+	};
+
+	std::mutex Mutex;
+
+	std::deque<Observation> Observations;
+
+	std::size_t Capacity;
+
+	static std::vector<double> asNumbers(const std::vector<std::string>& attributes)
+	{
+		std::vector<double> toReturn;
+
+		for(const std::string& a : attributes)
+		{
+			char* end = nullptr;
+			double value = std::strtod(a.c_str(),&end);
+			bool isNumber = !a.empty() && end == a.c_str() + a.size();
+
+			toReturn.push_back(isNumber ? value : std::numeric_limits<double>::quiet_NaN());
+		}
+
+		return toReturn;
+	}
+
+	public:
+
+	/**
+	* @param capacity The number of measurements that are remembered.
+	*/
+	CostEstimator(std::size_t capacity = 1024):
+		Capacity(capacity)
+	{}
+
+	/**
+	* Remembers the time a measurement took.
+	*/
+	void record(const std::vector<std::string>& attributes,double seconds)
+	{
+		std::lock_guard<std::mutex> guard(Mutex);
+
+		Observations.push_back(Observation{attributes,asNumbers(attributes),seconds});
+
+		if(Observations.size() > Capacity)
+		{
+			Observations.pop_front();
+		}
+	}
+
+	/**
+	* Returns the estimated time in seconds, or 0 if no measurement was
+	* solved yet.
+	*/
+	double estimate(const std::vector<std::string>& attributes)
+	{
+		std::lock_guard<std::mutex> guard(Mutex);
+
+		if(Observations.empty())
+		{
+			return 0;
+		}
+
+		std::vector<double> values = asNumbers(attributes);
+
+		std::vector<double> range(values.size(),0);
+		for(std::size_t a = 0;a < values.size();a++)
+		{
+			double lowest = values[a];
+			double highest = values[a];
+			for(Observation& o : Observations)
+			{
+				lowest = std::min(lowest,o.Values[a]);
+				highest = std::max(highest,o.Values[a]);
+			}
+			range[a] = highest - lowest;
+		}
+
+		double closestDistance = std::numeric_limits<double>::infinity();
+		double toReturn = 0;
+
+		for(Observation& o : Observations)
+		{
+			double distance = 0;
+
+			for(std::size_t a = 0;a < values.size();a++)
+			{
+				if(std::isnan(values[a]) || std::isnan(o.Values[a]))
+				{
+					distance += attributes[a] == o.Attributes[a] ? 0 : 1;
+				}
+				else if(range[a] > 0)
+				{
+					double d = (values[a] - o.Values[a])/range[a];
+					distance += d*d;
+				}
+			}
+
+			if(distance < closestDistance)
+			{
+				closestDistance = distance;
+				toReturn = o.Seconds;
+			}
+		}
+
+		return toReturn;
+	}
+};
 
 /**
-* This Mehthode sets the variable that tells the workerthreads that there is
-* more work to come to false. It is used to stop the workerthreads so that they
-* can be joined with the management thread.
+* The writing of the results is done by threads of its own, so the
+* workerthreads only solve systems. The workerthreads hand the solved systems
+* to the writerthreads through a queue. The queue holds only a limited number
+* of systems. If it is full, because the writing is slower than the solving,
+* the workerthreads wait until there is space again. This way, the memory
+* needed for the solved systems stays bounded.
 */
-void stopWork()
+class WriterStage
 {
-	std::lock_guard<std::mutex> guard(commonMutex);
-	Running = false;
-}
+	protected:
+
+	/**
+	* The solved systems and the functions that are called after they were
+	* written.
+	*/
+	BlockingQueue<std::pair<QuantumSystem*,std::function<void(bool)>>> Solved;
+
+	std::vector<std::thread> Writers;
+
+	/**
+	* The first exception thrown while a system was written. See error.
+	*/
+	std::exception_ptr Error;
+	std::mutex ErrorMutex;
+
+	void recordError()
+	{
+		std::lock_guard<std::mutex> guard(ErrorMutex);
+		if(!Error)
+		{
+			Error = std::current_exception();
+		}
+	}
+
+	/**
+	* This Method is executed by the writerthreads. It writes and deletes
+	* the solved systems until the stage is closed and the queue is empty.
+	* A system that can not be written is deleted as well. The exception is
+	* kept for error and the writerthread goes on with the next system, since
+	* an exception that leaves the thread would terminate the program.
+	*/
+	void write()
+	{
+		std::pair<QuantumSystem*,std::function<void(bool)>> problem;
+
+		while(Solved.pop(problem))
+		{
+			bool written = false;
+
+			try
+			{
+				problem.first->writeToFile();
+				written = true;
+			}
+			catch(...)
+			{
+				recordError();
+			}
+
+			delete problem.first;
+
+			if(problem.second)
+			{
+				try
+				{
+					problem.second(written);
+				}
+				catch(...)
+				{
+					recordError();
+				}
+			}
+		}
+	}
+
+	public:
+
+	~WriterStage()
+	{
+		drain();
+	}
+
+	/**
+	* Starts the writerthreads.
+	*
+	* @param writerCount The number of writerthreads. More than one is only
+	* useful if the storage can handle several files at once.
+	* @param capacity The maximal number of solved systems that wait to be
+	* written.
+	*/
+	void start(int writerCount,std::size_t capacity)
+	{
+		Error = nullptr;
+		Solved.reopen();
+		Solved.setCapacity(capacity);
+
+		for(int i = 0;i < writerCount;i++)
+		{
+			Writers.push_back(std::thread(&WriterStage::write,this));
+		}
+	}
+
+	/**
+	* Hands a solved system to the writerthreads. It blocks while the queue
+	* is full. The stage deletes the system after it was written.
+	*
+	* @param written Is called by the writerthread after the system was
+	* written and deleted, f.e. to release the memory it was counted with.
+	* Its parameter is false if writing the system failed. It is called in
+	* both cases.
+	*/
+	void push(QuantumSystem* problem,std::function<void(bool)> written = nullptr)
+	{
+		Solved.push({problem,written});
+	}
+
+	/**
+	* Returns the first exception thrown while a system was written since
+	* start, or nullptr. Call it after drain.
+	*/
+	std::exception_ptr error()
+	{
+		std::lock_guard<std::mutex> guard(ErrorMutex);
+		return Error;
+	}
+
+	/**
+	* Waits until all systems are written and stops the writerthreads.
+	*/
+	void drain()
+	{
+		Solved.shutdown();
+
+		for(std::thread& t : Writers)
+		{
+			t.join();
+		}
+		Writers.clear();
+	}
+};
 
 /**
-* This Method reads the Running boolean. It is used by the Workerthreads.
+* A file that lists the measurements of an experiment whose results are
+* completely written. Every line is appended and flushed to the disk as soon
+* as a result was written, so the file is valid even if the program is killed
+* in the middle of a long sweep. An interrupted experiment can then be resumed
+* without computing the finished measurements again (see Experiment::resume).
+* The layout is the one of METADATA.csv: a header and one line per measurement
+* with the file and the values of the attributes, separated by tabs. Tabs,
+* newlines and backslashes in the values are escaped with a backslash.
 */
-bool isRunning()
+class CompletionManifest
 {
-	std::lock_guard<std::mutex> guard(commonMutex);
-	return Running;
-}
+	public:
+
+	/**
+	* One completed measurement.
+	*/
+	struct Entry
+	{
+		std::string Path;
+		std::vector<std::string> Attributes;
+	};
+
+	protected:
+
+	std::mutex Mutex;
+
+	std::FILE* File = nullptr;
+
+	static std::string escape(const std::string& value)
+	{
+		std::string toReturn;
+
+		for(char c : value)
+		{
+			switch(c)
+			{
+				case '\\': toReturn += "\\\\"; break;
+				case '\t': toReturn += "\\t"; break;
+				case '\n': toReturn += "\\n"; break;
+				default: toReturn += c;
+			}
+		}
+
+		return toReturn;
+	}
+
+	/**
+	* Splits a line at the tabs and undoes the escaping.
+	*/
+	static std::vector<std::string> split(const std::string& line)
+	{
+		std::vector<std::string> fields(1);
+
+		for(std::size_t i = 0;i < line.size();i++)
+		{
+			if(line[i] == '\t')
+			{
+				fields.push_back("");
+			}
+			else if(line[i] == '\\' && i+1 < line.size())
+			{
+				i++;
+				fields.back() += line[i] == 't' ? '\t' : line[i] == 'n' ? '\n' : line[i];
+			}
+			else
+			{
+				fields.back() += line[i];
+			}
+		}
+
+		return fields;
+	}
+
+	static std::string line(const std::string& path,const std::vector<std::string>& attributes)
+	{
+		std::string toReturn = escape(path);
+
+		for(const std::string& a : attributes)
+		{
+			toReturn += '\t' + escape(a);
+		}
+
+		return toReturn + '\n';
+	}
+
+	/**
+	* Writes the text to the file and makes sure it reached the disk.
+	*/
+	void write(const std::string& text)
+	{
+		if(std::fputs(text.c_str(),File) == EOF || std::fflush(File) != 0)
+		{
+			throw std::runtime_error("Could not write to the manifest of the experiment.");
+		}
+#if defined(__unix__) || defined(__APPLE__)
+		fsync(fileno(File));
+#endif
+	}
+
+	/**
+	* Reads the complete lines of an existing manifest. A line that was cut
+	* off by a crash has no newline at its end and is ignored.
+	*/
+	static std::vector<Entry> read(const std::string& path,const std::vector<std::string>& attributeNames)
+	{
+		std::vector<Entry> entries;
+		std::ifstream file(path,std::ios::binary);
+		std::string text;
+
+		if(!file)
+		{
+			return entries;
+		}
+
+		bool header = true;
+		while(std::getline(file,text))
+		{
+			if(file.eof())
+			{
+				break;
+			}
+
+			std::vector<std::string> fields = split(text);
+
+			if(header)
+			{
+				std::vector<std::string> expected = {"RecordFile"};
+				expected.insert(expected.end(),attributeNames.begin(),attributeNames.end());
+
+				if(fields != expected)
+				{
+					throw std::runtime_error("The manifest " + path + " belongs to an experiment with other attributes.");
+				}
+				header = false;
+				continue;
+			}
+
+			if(fields.size() == attributeNames.size()+1)
+			{
+				entries.push_back({fields[0],std::vector<std::string>(fields.begin()+1,fields.end())});
+			}
+		}
+
+		return entries;
+	}
+
+	public:
+
+	CompletionManifest() {}
+
+	CompletionManifest(const CompletionManifest&) = delete;
+	CompletionManifest& operator=(const CompletionManifest&) = delete;
+
+	~CompletionManifest()
+	{
+		close();
+	}
+
+	/**
+	* Opens the manifest for appending.
+	*
+	* @param keepEntries If this is true, the completed measurements of an
+	* existing manifest are kept and returned. Otherwise a new manifest is
+	* started.
+	*/
+	std::vector<Entry> open(const std::string& path,const std::vector<std::string>& attributeNames,bool keepEntries)
+	{
+		std::lock_guard<std::mutex> guard(Mutex);
+
+		std::vector<Entry> entries;
+		if(keepEntries)
+		{
+			entries = read(path,attributeNames);
+		}
+
+		//The manifest is written again without the line that may have been
+		//cut off, the new lines are appended to it.
+		std::string temporary = path + ".tmp";
+		File = std::fopen(temporary.c_str(),"wb");
+		if(!File)
+		{
+			throw std::runtime_error("Could not create the manifest " + path);
+		}
+
+		std::string text = line("RecordFile",attributeNames);
+		for(Entry& e : entries)
+		{
+			text += line(e.Path,e.Attributes);
+		}
+		write(text);
+
+		if(std::rename(temporary.c_str(),path.c_str()) != 0)
+		{
+			throw std::runtime_error("Could not create the manifest " + path);
+		}
+
+		return entries;
+	}
+
+	/**
+	* Appends a completed measurement. Does nothing if the manifest is not
+	* open.
+	*/
+	void append(const std::string& path,const std::vector<std::string>& attributes)
+	{
+		std::lock_guard<std::mutex> guard(Mutex);
+
+		if(File)
+		{
+			write(line(path,attributes));
+		}
+	}
 
-/**
-* This Method appends a new job to the back of the WorkSource queue. It is used
-* by the management-thread to distribute new work.
-*/
-void pushJob(std::pair<QuantumSystem*,Solver*> job)
-{
-	std::lock_guard<std::mutex> guard(commonMutex);
-	WorkSource.push(job);
-}
+	void close()
+	{
+		std::lock_guard<std::mutex> guard(Mutex);
 
-/**
-* This Method pops one job from the worksource queue and return it. It is used
-* by the workerthreads to source new work.
-*/
-std::pair<QuantumSystem*,Solver*> getJob()
-{
-	std::lock_guard<std::mutex> guard(commonMutex);
-	std::pair<QuantumSystem*,Solver*> toReturn = WorkSource.front();
-	WorkSource.pop();
-		
-	return toReturn;
-}
+		if(File)
+		{
+			std::fclose(File);
+			File = nullptr;
+		}
+	}
+};
 
 /**
-* This Method is executed by the workerthreads and defines their behaviour. 
+* Returns half of the physical memory of the computer in bytes, or 0 (no
+* limit) if it can not be determined. It is the default memory budget of an
+* experiment (see Experiment::useMemoryBudget).
 */
-void run(std::string test)
+inline std::size_t defaultMemoryBudget()
 {
-	
-	while(isRunning())
+#if defined(_SC_PHYS_PAGES) && defined(_SC_PAGE_SIZE)
+	long pages = sysconf(_SC_PHYS_PAGES);
+	long pageSize = sysconf(_SC_PAGE_SIZE);
+
+	if(pages > 0 && pageSize > 0)
 	{
-		while(thereIsJob())
-		{
-			QuantumSystem* problem;
-			Solver* s;
-	
-			std::tie(problem,s) = getJob();
-					
-			s->solve();
-				
-			delete s;
-			problem->writeToFile();
-			delete problem;
-		}
-		std::this_thread::sleep_for(std::chrono::milliseconds(1));	
+		return (std::size_t)pages*(std::size_t)pageSize/2;
 	}
+#endif
+	return 0;
 }
 
 /**
@@ -202,6 +940,17 @@ class Experiment
 		* of the parameters specified in attributes.
 		*/
 		std::vector<std::pair<std::string,std::vector<std::string>>> Column;
+
+		/**
+		* Whether the record of an entry in Column was written. Only written
+		* records are listed in the metadata file.
+		*/
+		std::vector<bool> Written;
+
+		/**
+		* Records are marked as written by the writerthreads.
+		*/
+		std::mutex ColumnMutex;
 		
 		/**
 		* Writes the metadata file for this experiment.
@@ -211,6 +960,8 @@ class Experiment
 			char delimiter = '\t';
 			char newLine = '\n';
 
+			std::lock_guard<std::mutex> guard(ColumnMutex);
+
 			std::ofstream file(ProjectFolder+"/METADATA.csv");
 
 			file << "RecordFile" << delimiter;
@@ -220,8 +971,14 @@ class Experiment
 			}
 			file << newLine;
 
-			for(auto& p : Column)
+			for(std::size_t i = 0;i < Column.size();i++)
 			{
+				if(!Written[i])
+				{
+					continue;
+				}
+
+				auto& p = Column[i];
 				file << p.first << delimiter;
 
 				for(std::string& s: p.second)
@@ -272,15 +1029,32 @@ class Experiment
 		{}
 		
 		/**
-		* Adds one entire to the column of records.
+		* Adds one entire to the column of records. The entries keep the order
+		* in which they are logged, no matter when they are written.
+		*
+		* @param written false if the record is not written yet. It is only
+		* listed in the metadata file after markWritten was called.
+		* @return The index of the entry.
 		*/
-		void logRecord(std::string PathToRecord, std::vector<std::string> attributeValues)
+		std::size_t logRecord(std::string PathToRecord, std::vector<std::string> attributeValues,bool written = true)
 		{
 			if(AttributeNames.size() != attributeValues.size())
 			{
 				throw std::runtime_error("Number of Attributes in metadata logging don't match.");
 			}
+			std::lock_guard<std::mutex> guard(ColumnMutex);
 			Column.push_back(std::make_pair(PathToRecord,attributeValues));
+			Written.push_back(written);
+			return Column.size() - 1;
+		}
+
+		/**
+		* Lists a logged record in the metadata file.
+		*/
+		void markWritten(std::size_t index)
+		{
+			std::lock_guard<std::mutex> guard(ColumnMutex);
+			Written[index] = true;
 		}
 		
 		/**
@@ -297,6 +1071,11 @@ class Experiment
 		{
 			return ProjectFolder;
 		}
+
+		const std::vector<std::string>& attributeNames()
+		{
+			return AttributeNames;
+		}
 	};
 	
 	/**
@@ -317,9 +1096,121 @@ class Experiment
 	MetaDataSet MetaData;
 	
 	/**
-	* The Workerthreads.
+	* The pool of the experiment, if it was not given a shared one.
 	*/
-	std::vector<std::thread> Workers;
+	std::unique_ptr<WorkerPool> OwnPool;
+
+	/**
+	* The Workerthreads that solve the systems.
+	*/
+	WorkerPool* Pool;
+
+	/**
+	* Guards the bookkeeping of the jobs of this experiment below.
+	*/
+	std::mutex JobMutex;
+
+	/**
+	* Signals the management thread that a job was started or finished.
+	*/
+	std::condition_variable JobProgress;
+
+	/**
+	* The number of jobs of this experiment that were submitted to the pool
+	* but not started yet.
+	*/
+	std::size_t QueuedJobs = 0;
+
+	/**
+	* The number of jobs of this experiment that were submitted to the pool
+	* but are not finished yet.
+	*/
+	std::size_t UnfinishedJobs = 0;
+
+	/**
+	* The first exception thrown by a job or by a writerthread. Conduct throws
+	* it again after all jobs are finished and all results are written.
+	*/
+	std::exception_ptr JobError;
+
+	/**
+	* Learns how long the measurements of this experiment take (see
+	* MeasurementCost).
+	*/
+	CostEstimator Costs;
+
+	/**
+	* The number of bytes the jobs of this experiment may use together, from
+	* their construction until their results are written. 0 means no limit
+	* (see useMemoryBudget).
+	*/
+	std::size_t MemoryBudget = defaultMemoryBudget();
+
+	/**
+	* The number of bytes reserved for the jobs that are constructed but not
+	* written yet.
+	*/
+	std::size_t ReservedBytes = 0;
+
+	/**
+	* The number of bytes that are reserved for the next job. It is the
+	* footprint of the last job that was constructed.
+	*/
+	std::size_t NextFootprint = 0;
+
+	/**
+	* The largest footprint of a solved system of this experiment, 0 if no
+	* system was solved yet.
+	*/
+	std::size_t LargestFootprint = 0;
+
+	/**
+	* The archive all measurements are saved in, if the archive mode is used
+	* (see useArchive). Otherwise every measurement writes a file of its own.
+	*/
+	std::unique_ptr<ResultArchive> Archive;
+
+	/**
+	* The threads that write the results of the solved systems.
+	*/
+	WriterStage Writers;
+
+	/**
+	* The number of writerthreads and the number of solved systems that may
+	* wait for them (see useWriters).
+	*/
+	int WriterCount = 1;
+	std::size_t WriteQueueCapacity = 0;
+
+	/**
+	* If this is true, the topology of the systems is saved only once (see
+	* useSharedTopology).
+	*/
+	bool ShareTopology = false;
+
+	/**
+	* The store for the topologies if they are shared and no archive is used.
+	*/
+	std::unique_ptr<FolderTopologyStore> FolderTopologies;
+
+	/**
+	* Lists the measurements whose results are written, if no archive is
+	* used. It is the MANIFEST.csv in the project folder.
+	*/
+	CompletionManifest Manifest;
+
+	/**
+	* How completed measurements are recognized if the experiment is resumed.
+	*/
+	enum class ResumeBy {Nothing,Attributes,Path};
+	ResumeBy Resume = ResumeBy::Nothing;
+
+	/**
+	* The attributes and the files of the measurements that were completed
+	* before the experiment was resumed.
+	*/
+	std::set<std::vector<std::string>> CompletedAttributes;
+	std::set<std::string> CompletedPaths;
 	
 	/**
 	* This method must be defined by the user. It returns a measurement that
@@ -336,26 +1227,244 @@ class Experiment
 				>	NextMeasurement()=0;
 	
 	/**
-	* This method returns the number of measurements that is not saved in the
-	* WorkSource queue or already processed. It is used in conjunction with
+	* Returns an estimate of the time it takes to solve the measurement with
+	* the given attributes, f.e. in seconds. The workerthreads start the most
+	* expensive of the waiting measurements first, which shortens the time
+	* where only a few long measurements are left and the other threads are
+	* idle. The default estimate is learned from the measurements that were
+	* already solved (see CostEstimator). Override it if the cost is known
+	* better, f.e. near resonances.
+	*/
+	virtual double MeasurementCost(const std::vector<std::string>& attributes)
+	{
+		return Costs.estimate(attributes);
+	}
+
+	/**
+	* Returns the number of bytes the given measurement will use until its
+	* result is written. The memory budget of the experiment is split between
+	* the jobs with these values (see useMemoryBudget). Until the first system
+	* is solved, it is the estimate of QuantumSystem::estimatedMemoryFootprint,
+	* afterwards the largest footprint of the solved systems. Override it if
+	* the measurements differ much in size.
+	*/
+	virtual std::size_t MeasurementFootprint(QuantumSystem* system)
+	{
+		std::size_t largest;
+		{
+			std::lock_guard<std::mutex> guard(JobMutex);
+			largest = LargestFootprint;
+		}
+
+		return largest > 0 ? largest : system->estimatedMemoryFootprint();
+	}
+
+	/**
+	* Returns true if the measurement was completed before the experiment was
+	* resumed.
+	*/
+	bool isCompleted(const std::vector<std::string>& attributes,QuantumSystem* system)
+	{
+		switch(Resume)
+		{
+			case ResumeBy::Attributes: return CompletedAttributes.count(attributes) > 0;
+			case ResumeBy::Path: return CompletedPaths.count(system->pathToSave()) > 0;
+			default: return false;
+		}
+	}
+
+	/**
+	* Returns true if another job may be constructed. Jobs are constructed in
+	* advance as long as the memory budget allows it, up to five jobs per
+	* workerthread. If the budget is tight, jobs are only constructed when
+	* the memory of another one was released. If no memory is reserved, one
+	* job is allowed even if it exceeds the budget.
+	* JobMutex must be held.
+	*/
+	bool mayConstructJob()
+	{
+		if(QueuedJobs >= (std::size_t)WorkerCount * 5)
+		{
+			return false;
+		}
+
+		return ReservedBytes == 0 || MemoryBudget == 0 ||
+			ReservedBytes + NextFootprint <= MemoryBudget;
+	}
+
+	/**
+	* This method returns the number of measurements that is not submitted to
+	* the pool or already processed. It is used in conjunction with
 	* InitialMeasurementCount to log the progress of the simulation to the terminal.
 	*/
 	virtual int MeasurementsToCome()=0;
 	
 	/**
-	* This method refills the WorkSource queue if the number of jobs there,
-	* available for the workerthreads is running low.
+	* Returns the number of jobs of this experiment that wait for a
+	* workerthread.
+	*/
+	int jobsInPendingQueue()
+	{
+		std::lock_guard<std::mutex> guard(JobMutex);
+		return QueuedJobs;
+	}
+
+	/**
+	* Gives back the memory that was reserved for a job.
+	*/
+	void releaseFootprint(std::size_t footprint)
+	{
+		std::lock_guard<std::mutex> guard(JobMutex);
+		ReservedBytes -= footprint;
+		JobProgress.notify_all();
+	}
+
+	/**
+	* Submits a measurement to the pool. The job solves the system, hands it
+	* to the writerthreads and records how long the solving took and how
+	* much memory the solved system uses.
+	*
+	* @param attributes The values of the attributes of the measurement.
+	* @param footprint The number of bytes reserved for the job. They are
+	* released after the result was written.
+	* @param record The index of the measurement in METADATA.csv. It is only
+	* marked as written once the result was written, so a measurement that
+	* failed is not listed.
+	*/
+	void submitJob(std::pair<QuantumSystem*,Solver*> job,const std::vector<std::string>& attributes,std::size_t footprint,std::size_t record)
+	{
+		{
+			std::lock_guard<std::mutex> guard(JobMutex);
+			QueuedJobs++;
+			UnfinishedJobs++;
+			ReservedBytes += footprint;
+			NextFootprint = footprint;
+		}
+
+		std::string path = job.first->pathToSave();
+
+		Pool->submit([this,job,attributes,footprint,path,record]()
+		{
+			{
+				std::lock_guard<std::mutex> guard(JobMutex);
+				QueuedJobs--;
+				JobProgress.notify_all();
+			}
+
+			bool solverDeleted = false;
+			bool handedToWriters = false;
+
+			try
+			{
+				auto begin = std::chrono::steady_clock::now();
+				job.second->solve();
+				Costs.record(attributes,std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count());
+
+				std::size_t solvedFootprint = job.first->memoryFootprint();
+				{
+					std::lock_guard<std::mutex> guard(JobMutex);
+					LargestFootprint = std::max(LargestFootprint,solvedFootprint);
+				}
+
+				delete job.second;
+				solverDeleted = true;
+				Writers.push(job.first,[this,footprint,path,attributes,record](bool written)
+				{
+					//The footprint is released first, so a failing manifest
+					//can not keep the management thread waiting for memory.
+					releaseFootprint(footprint);
+
+					if(written)
+					{
+						Manifest.append(path,attributes);
+						MetaData.markWritten(record);
+					}
+				});
+				handedToWriters = true;
+			}
+			catch(...)
+			{
+				std::lock_guard<std::mutex> guard(JobMutex);
+				if(!JobError)
+				{
+					JobError = std::current_exception();
+				}
+				if(!handedToWriters)
+				{
+					ReservedBytes -= footprint;
+				}
+			}
+
+			//Whatever was not handed to the writerthreads is deleted here.
+			if(!solverDeleted)
+			{
+				delete job.second;
+			}
+			if(!handedToWriters)
+			{
+				delete job.first;
+			}
+
+			//The notification is sent under the lock, because the experiment
+			//may be destroyed as soon as the management thread sees that
+			//all jobs are finished.
+			std::lock_guard<std::mutex> guard(JobMutex);
+			UnfinishedJobs--;
+			JobProgress.notify_all();
+		},MeasurementCost(attributes));
+	}
+
+	/**
+	* This method refills the queue of the pool if the number of jobs of this
+	* experiment there, available for the workerthreads is running low.
 	*/
 	void managePendingJobs()
 	{
 		if(jobsInPendingQueue() < WorkerCount * 3 && MeasurementsToCome() != 0)
 		{
-			while(jobsInPendingQueue() < WorkerCount * 5)
+			while(true)
 			{
+				{
+					std::lock_guard<std::mutex> guard(JobMutex);
+					if(!mayConstructJob())
+					{
+						break;
+					}
+				}
+
 				auto attributesNjob = NextMeasurement();
+
+				if(isCompleted(attributesNjob.first,attributesNjob.second.first))
+				{
+					delete attributesNjob.second.second;
+					delete attributesNjob.second.first;
+
+					if(MeasurementsToCome() <= 0)
+					{
+						break;
+					}
+					continue;
+				}
+
+				std::size_t footprint = std::max<std::size_t>(1,MeasurementFootprint(attributesNjob.second.first));
+				std::string recordFile = attributesNjob.second.first->pathToSave();
 				
-				MetaData.logRecord(attributesNjob.second.first->pathToSave(),attributesNjob.first);
-				pushJob(attributesNjob.second);
+				if(Archive)
+				{
+					std::size_t record = Archive->addRecord(attributesNjob.first);
+					attributesNjob.second.first->saveToArchive(Archive.get(),record);
+					recordFile = Archive->path()+"#"+std::to_string(record);
+				}
+				if(ShareTopology)
+				{
+					TopologyStore* topologies = Archive ? (TopologyStore*)Archive.get() : FolderTopologies.get();
+					attributesNjob.second.first->shareTopology(topologies);
+				}
+				//The row is reserved now, so METADATA.csv lists the
+				//measurements in their order and not in the order they
+				//finish.
+				std::size_t record = MetaData.logRecord(recordFile,attributesNjob.first,false);
+				submitJob(attributesNjob.second,attributesNjob.first,footprint,record);
 
 				if(MeasurementsToCome() <= 0)
 				{
@@ -385,24 +1494,33 @@ class Experiment
 	void WaitForCalculation()
 	{
 		int jobsPending = jobsInPendingQueue() + MeasurementsToCome();
-		
-		int loopCount = 0;
 
 		while(jobsPending > 0)
 		{
 			managePendingJobs();
-			
-			loopCount ++;
+			logStatusToTerminal(jobsPending);
 
-			if(loopCount >= 100)
+			//Sleeps until the workerthreads took so many jobs that the queue
+			//must be refilled and the memory budget allows it, or until all
+			//jobs are started if there are no more measurements. Every job
+			//that is started, finished or whose memory is released notifies
+			//JobProgress, so the thread is woken by these events. The timeout
+			//is only a safety net.
+			bool moreToCome = MeasurementsToCome() > 0;
+			std::size_t low = moreToCome ? WorkerCount * 3 : 1;
 			{
-				logStatusToTerminal(jobsPending);
-				loopCount = 0;
+				std::unique_lock<std::mutex> lock(JobMutex);
+				JobProgress.wait_for(lock,std::chrono::seconds(5),[this,low,moreToCome]()
+				{
+					return QueuedJobs < low && (!moreToCome || mayConstructJob());
+				});
 			}
 
-			std::this_thread::sleep_for(std::chrono::milliseconds(1));	
 			jobsPending = jobsInPendingQueue() + MeasurementsToCome();
 		}
+
+		std::unique_lock<std::mutex> lock(JobMutex);
+		JobProgress.wait(lock,[this](){return UnfinishedJobs == 0;});
 	}
 
 	public:
@@ -419,36 +1537,185 @@ class Experiment
 	)
 	:WorkerCount(pWorkerCount),
 	 InitialMeasurementCount(pInitialMeasurementCount),
-	 MetaData(projectFolder,attributeNames,constantParameters,description,motivation)
+	 MetaData(projectFolder,attributeNames,constantParameters,description,motivation),
+	 OwnPool(new WorkerPool(pWorkerCount)),
+	 Pool(OwnPool.get())
+	{}
+
+	/**
+	* Creates an experiment that uses the workerthreads of the given pool.
+	* The pool can be shared with other experiments, also with ones that are
+	* conducted at the same time (see ConductAsync). It must live longer
+	* than the experiment.
+	*/
+	Experiment
+	(
+		WorkerPool& pool,
+		int pInitialMeasurementCount,
+		std::string projectFolder,
+		std::vector<std::string> attributeNames,
+		std::vector<std::pair<std::string,std::string>> constantParameters,
+		std::string description,
+		std::string motivation
+	)
+	:WorkerCount(pool.workerCount()),
+	 InitialMeasurementCount(pInitialMeasurementCount),
+	 MetaData(projectFolder,attributeNames,constantParameters,description,motivation),
+	 Pool(&pool)
 	{}
+
+	virtual ~Experiment()
+	{
+		//The own pool must finish the jobs of this experiment before the
+		//members they use are destroyed.
+		OwnPool.reset();
+	}
 	
+	/**
+	* Saves all measurements of this experiment in one archive in the project
+	* folder instead of one file per measurement (see ResultArchive). The
+	* RecordFile column of METADATA.csv then holds the archive and the number
+	* of the measurement in it, f.e. "folder/RESULTS.archive#12". Must be
+	* called before Conduct.
+	*/
+	void useArchive(std::string fileName = "RESULTS.archive")
+	{
+		Archive.reset(new ResultArchive(MetaData.projectFolder()+"/"+fileName,MetaData.attributeNames()));
+	}
+
+	/**
+	* Configures the writing of the results. The results are written by
+	* writerthreads, so the workerthreads can go on solving while a result
+	* is written.
+	*
+	* @param writerCount The number of writerthreads. The default is 1.
+	* @param queueCapacity The maximal number of solved systems waiting to be
+	* written. If the queue is full, the workerthreads wait. The default is
+	* twice the number of workerthreads.
+	*/
+	void useWriters(int writerCount,std::size_t queueCapacity)
+	{
+		WriterCount = writerCount;
+		WriteQueueCapacity = queueCapacity;
+	}
+
+	/**
+	* Limits the memory the jobs of this experiment use. Jobs are constructed
+	* before a workerthread is free to take them, so the workerthreads never
+	* wait for the construction. Since a job holds the states of its system
+	* from the construction on, this is only done as long as the reserved
+	* footprints of all jobs that are not written yet fit into the budget
+	* (see MeasurementFootprint). If a single job does not fit, the jobs are
+	* constructed one after another. The default budget is half of the
+	* physical memory.
+	*
+	* @param bytes The budget in bytes. 0 means no limit.
+	*/
+	void useMemoryBudget(std::size_t bytes)
+	{
+		MemoryBudget = bytes;
+	}
+
+	/**
+	* Saves the niveaus, states and edges only once for all measurements
+	* with the same topology, under the hash of the topology. The measurements
+	* only store the values of their keyframes (see
+	* QuantumSystem::shareTopology). The topologies are saved in the archive
+	* if useArchive is used, otherwise as <hash>.topology files in the project
+	* folder. Must be called before Conduct.
+	*/
+	void useSharedTopology()
+	{
+		ShareTopology = true;
+		FolderTopologies.reset(new FolderTopologyStore(MetaData.projectFolder()));
+	}
+
+	/**
+	* Continues an experiment that was interrupted, f.e. by a crash. The
+	* measurements listed in the MANIFEST.csv of the project folder are
+	* not simulated again. They are recognized by the values of their
+	* attributes or, if byPath is true, by the file they are saved to.
+	* METADATA.csv is rebuilt from the manifest right away and completed by
+	* Conduct. Experiments that use an archive can not be resumed, since the
+	* index of the archive is only written at the end. Must be called
+	* before Conduct.
+	*/
+	void resume(bool byPath = false)
+	{
+		Resume = byPath ? ResumeBy::Path : ResumeBy::Attributes;
+	}
+
 	/**
 	* Starts the parallel calculation of the simulations that make up this
-	* experiment. 
+	* experiment and returns when all results and the metadata are written.
+	* The calling thread is the management thread.
 	*/
 	void Conduct()
 	{
-		startWork();
-		
-		for(int i =0; i< WorkerCount;i++)
+		JobError = nullptr;
+
+		if(Archive && Resume != ResumeBy::Nothing)
 		{
-			std::string tIden = "T"+std::to_string(i+1);
-			Workers.push_back(std::thread(run,tIden));
+			throw std::runtime_error("Experiments that are saved in an archive can not be resumed.");
+		}
+
+		if(!Archive)
+		{
+			auto completed = Manifest.open(MetaData.projectFolder()+"/MANIFEST.csv",MetaData.attributeNames(),Resume != ResumeBy::Nothing);
+
+			for(CompletionManifest::Entry& e : completed)
+			{
+				MetaData.logRecord(e.Path,e.Attributes);
+				CompletedAttributes.insert(e.Attributes);
+				CompletedPaths.insert(e.Path);
+			}
+
+			if(!completed.empty())
+			{
+				MetaData.writeToFiles();
+				std::cout << completed.size() << " measurements were completed before." << std::endl;
+			}
 		}
-		
+
+		Writers.start(WriterCount,WriteQueueCapacity > 0 ? WriteQueueCapacity : 2*WorkerCount);
 
 		WaitForCalculation();
-		
-		stopWork();
 
-		for(std::thread& t : Workers)
+		Writers.drain();
+		Manifest.close();
+
 		{
-			t.join();
+			std::lock_guard<std::mutex> guard(JobMutex);
+			if(!JobError)
+			{
+				JobError = Writers.error();
+			}
 		}
 		
 		std::cout << std::endl;
 
+		if(Archive)
+		{
+			Archive->close();
+		}
+
 		MetaData.writeToFiles();
+
+		if(JobError)
+		{
+			std::rethrow_exception(JobError);
+		}
+	}
+
+	/**
+	* Conducts the experiment on a management thread of its own. Experiments
+	* that share a WorkerPool can be conducted at the same time this way. The
+	* future is ready when Conduct would have returned and throws the
+	* exceptions Conduct would have thrown.
+	*/
+	std::future<void> ConductAsync()
+	{
+		return std::async(std::launch::async,[this](){Conduct();});
 	}
 };
 
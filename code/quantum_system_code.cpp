@@ -4,6 +4,20 @@
 #include<utility>
 #include<fstream>
 #include<cmath>
+#include<algorithm>
+#include<cstdint>
+#include<memory>
+#include<deque>
+#include<set>
+#include<sstream>
+#include<iomanip>
+#include<cstdio>
+#include<stdexcept>
+#include<cstring>
+#include<limits>
+#include<unordered_map>
+
+#include "result_archive_code.cpp"
 
 /**
 * In this unoverwritten state this class mainly exists for the user. It holds
@@ -92,6 +106,17 @@ class Niveau
 		file << indent << "</niveau>\n";
 	}
 
+	/**
+	* Writes the data that is held by this class in the binary output format.
+	*/
+	void writeToBinaryFile(std::ostream& file)
+	{
+		writeLittleEndian(file,Name);
+		writeLittleEndian(file,Energy);
+		writeLittleEndian(file,Spin);
+		writeLittleEndian(file,Charge);
+	}
+
 };
 
 /**
@@ -99,71 +124,113 @@ class Niveau
 * the levels that are occupied in the given state. (see on the main page). When
 * working with array it can be easyer to have this number decimal. However, when
 * transition edges are assigned to the system it may be easyer to work with the
-* binary number.
+* binary number.<br>
+* The bits are stored in Words 64 bit integers, so the number never allocates
+* memory and copies are cheap. Bit i of the binary string is bit i%64 of
+* Word[i/64]. One word is enough for the state numbers of every system that
+* fits in memory, more words can be used to describe states of systems with
+* more than 64 levels.
 */
-struct BinaryNumber
+template<std::size_t Words>
+struct BasicBinaryNumber
 {
 	/**
 	* The binary representation of the number.
 	*/
-	bool* Number;
+	std::uint64_t Word[Words] = {};
 
 	/**
 	* The number of digits of the binary representation.
 	*/
-	int NumberOfDigits;
+	int NumberOfDigits = 0;
 
 	/**
-	* @param digits The number of digits the new binary number has.
+	* Iterates over the indices of the bits that are one, starting with the
+	* lowest.
 	*/
-	BinaryNumber(int digits, int value = 0)
-	:
-		Number(new bool[digits]),
-		NumberOfDigits(digits)
+	struct OnesIterator
 	{
-		
-		int remant = value;
+		const BasicBinaryNumber* Owner;
+		int Digit;
 
-		for(int i = 0;i < digits;i++)
+		int operator*() const
 		{
-			int index = digits - i - 1;
+			return Digit;
+		}
 
-			if(remant == 0)
-			{
-				Number[index] = 0;
-				continue;
-			}
+		OnesIterator& operator++()
+		{
+			Digit = Owner->nextOne(Digit+1);
+			return *this;
+		}
 
-			int digitValue = (int) pow(2,index);
-			
-			Number[index] = ((remant/digitValue)>=1);
-			
-			remant = remant%digitValue;
+		bool operator!=(const OnesIterator& other) const
+		{
+			return Digit != other.Digit;
 		}
-	}
-	
+	};
+
+	/**
+	* The range of the bits that are one. Use it as
+	* for(int level : number.ones()).
+	*/
+	struct OnesRange
+	{
+		const BasicBinaryNumber* Owner;
+
+		OnesIterator begin() const
+		{
+			return {Owner,Owner->nextOne(0)};
+		}
+
+		OnesIterator end() const
+		{
+			return {Owner,Owner->NumberOfDigits};
+		}
+	};
+
+	constexpr BasicBinaryNumber() {}
+
 	/**
-	* Frees the Array for the binary representation.
+	* @param digits The number of digits the new binary number has.
+	* @param value The value of the number. Only the lowest 64 bits can be set
+	* this way.
 	*/
-	~BinaryNumber()
+	constexpr BasicBinaryNumber(int digits, std::uint64_t value = 0)
+	:
+		NumberOfDigits(digits)
 	{
+		Word[0] = value;
+		clearUnusedBits();
 	}
 
 	/**
-	* Returns the decimal representation of the number.
+	* Sets the bits above NumberOfDigits to zero.
 	*/
-	int asDecimal()
+	constexpr void clearUnusedBits()
 	{
-		int power = 1;
-		int decimalValue = 0;
-		
-		for(int i = 0; i < NumberOfDigits; i++)
+		for(std::size_t w = 0;w < Words;w++)
 		{
-			decimalValue += Number[i]*power;
-			power *= 2;
+			int first = (int)(64*w);
+
+			if(NumberOfDigits <= first)
+			{
+				Word[w] = 0;
+			}
+			else if(NumberOfDigits < first+64)
+			{
+				Word[w] &= (std::uint64_t(1) << (NumberOfDigits-first)) - 1;
+			}
 		}
+	}
 
-		return decimalValue;
+	/**
+	* Returns the decimal representation of the number. For numbers with more
+	* than 64 digits only the lowest 64 bits are returned.
+	*/
+	constexpr std::uint64_t asDecimal() const
+	{
+		return Word[0];
 	}
 
 	/**
@@ -173,12 +240,10 @@ struct BinaryNumber
 	*
 	* @param digit The index of the bit that should be flipped.
 	*/
-	BinaryNumber bitFlip(int digit)
+	constexpr BasicBinaryNumber bitFlip(int digit) const
 	{
-
-		Number[digit] = !Number[digit];
-		BinaryNumber toReturn = BinaryNumber(NumberOfDigits,asDecimal());
-		Number[digit] = !Number[digit];
+		BasicBinaryNumber toReturn = *this;
+		toReturn.Word[digit/64] ^= std::uint64_t(1) << (digit%64);
 		
 		return toReturn;
 	}
@@ -189,9 +254,9 @@ struct BinaryNumber
 	* @param digit The digit that should be returned, i.e. the place in the
 	* binary string.
 	*/
-	bool readBit(int digit)
+	constexpr bool readBit(int digit) const
 	{
-		return Number[digit];
+		return (Word[digit/64] >> (digit%64)) & 1;
 	}
 	
 	/**
@@ -200,23 +265,27 @@ struct BinaryNumber
 	* @param digit The index of the bit that is set.
 	* @param value The new value of the bit.
 	*/
-	void setBit(int digit,bool value)
+	constexpr void setBit(int digit,bool value)
 	{
-		Number[digit] = value;
+		std::uint64_t bit = std::uint64_t(1) << (digit%64);
+
+		if(value)
+			Word[digit/64] |= bit;
+		else
+			Word[digit/64] &= ~bit;
 	}
 
 	/**
 	* Returns the Number of bits that are one in the binary string that encodes
 	* thins number.
 	*/
-	int numberOfOnes()
+	constexpr int numberOfOnes() const
 	{
 		int ones = 0;
 
-		for(int i =0;i<NumberOfDigits;i++)
+		for(std::size_t w = 0;w < Words;w++)
 		{
-			if(Number[i])
-				ones++;
+			ones += __builtin_popcountll(Word[w]);
 		}
 
 		return ones;
@@ -226,498 +295,2754 @@ struct BinaryNumber
 	* Returns the number of bits that are zero in the binary string of this
 	* number.
 	*/
-	int numberOfZeros()
+	constexpr int numberOfZeros() const
 	{
-		int zeros = 0;
-		
-		for(int i =0;i<NumberOfDigits;i++)
+		return NumberOfDigits - numberOfOnes();
+	}
+
+	/**
+	* Returns the index of the lowest bit that is one and not below digit. If
+	* there is no such bit NumberOfDigits is returned.
+	*/
+	constexpr int nextOne(int digit) const
+	{
+		while(digit < NumberOfDigits)
+		{
+			std::uint64_t rest = Word[digit/64] >> (digit%64);
+
+			if(rest != 0)
+			{
+				return digit + __builtin_ctzll(rest);
+			}
+
+			digit = (digit/64 + 1)*64;
+		}
+
+		return NumberOfDigits;
+	}
+
+	/**
+	* Returns the indices of the bits that are one.
+	*/
+	OnesRange ones() const
+	{
+		return {this};
+	}
+
+	constexpr bool operator==(const BasicBinaryNumber& other) const
+	{
+		for(std::size_t w = 0;w < Words;w++)
 		{
-			if(!Number[i])
-				zeros++;
+			if(Word[w] != other.Word[w])
+				return false;
 		}
 
-		return zeros;
+		return NumberOfDigits == other.NumberOfDigits;
+	}
+
+	constexpr bool operator!=(const BasicBinaryNumber& other) const
+	{
+		return !(*this == other);
 	}
 };
 
 /**
-* This Class represents a Quantumsystem with discrete finite states. It
-* encapsulates all the physics that make up the System. The System is Stored as
-* a Graph. The Nodes in the graph are the states the system can be in. The edges
-* are the different transitions that can occur. The weight of the edges is the
-* probability that a transition occurs in a Unit time.<br>
-* This Class handles all access on the physical parameters of the system, be it
-* the request of a masterequation or transition probabilities for single states.
-* This way, the QuantumSystem object can keep Track of the access and can create
-* a "on the fly" look-up-table so that already known physical data must not be
-* computed twice. This way, assuming the evaluation of the physical equations
-* describing the system is expensive, runtime can be saved. This assumption
-* seems legit, since most of the time one is dealing with exponentials when
-* describing quantum Systems.<br>
-* All concrete quantum Systems should be subclasses of this abstract base. All
-* solvers should be implemented using the abstract base. This way, it is save,
-* that they all can operate on every Quantumsystem that is described using this
-* library.<br>
-* The informations about the physics of the System are strored in the Graph,
-* representing the system and its dynamics. A subclass must override the actualisationNeedet
-* and the calculateProbabilities functions. The first of which is checking if
-* the transition probabilities for a given state at a given time should be
-* calculated. The second adds the edges to the graph.
-* This class also saves the state of the System i.e. the occupation of the
-* states and the transition probabilities at a given time. It can write this
-* data to a graphml file. 
+* The number type of the states of a QuantumSystem. Existing code that works
+* with bitFlip, readBit, setBit, asDecimal and numberOfOnes compiles unchanged
+* against it.
+*/
+typedef BasicBinaryNumber<1> BinaryNumber;
+
+/**
+* The Matrix of the masterequation stored in compressed sparse column format.
+* Column j holds the rates of the transitions that leave the state with the
+* number j, so every edge of the graph becomes one entry and every state one
+* diagonal entry. The memory and the cost of a multiplication scale with the
+* number of edges instead of the square of the number of states.<br>
+* The layout is the same one armadillo uses for its sparse matrices. The
+* matrix can therefore be handed to armadillo without reordering if a solver
+* needs a factorisation.
 */
-class QuantumSystem
+class SparseMasterEquation
 {
 	protected:
 
-	class State;
-	
-	/*
-	* This Class represents a (directed) edge in the Graph describing the physics of this
-	* quantumsystem. 
-	*/	
-	struct Edge
+	/**
+	* The number of rows and columns, i.e. the number of states.
+	*/
+	arma::uword Dimension = 0;
+
+	/**
+	* ColumnPointers[j] is the index of the first entry of column j in
+	* RowIndices and Values. The last element is the number of entries.
+	*/
+	std::vector<arma::uword> ColumnPointers = {0};
+
+	/**
+	* The row of every stored entry. Inside a column the rows are sorted.
+	*/
+	std::vector<arma::uword> RowIndices;
+
+	/**
+	* The value of every stored entry.
+	*/
+	std::vector<double> Values;
+
+	/**
+	* Returns the index of the first entry of column j in RowIndices and
+	* Values. Columns after the last appended one are empty.
+	*/
+	arma::uword columnBegin(arma::uword j) const
 	{
-		/**
-		* The State on which the edge is pointing. This is the endstate of the
-		* transition the edge is symbolizing.
-		*/
-		State& targetState;
-		
-		/**
-		* The Probability that the Transition the Edge is Symbolizing is
-		* occurring.
-		*/
-		double transitionProbabilitie;
-		
-		/**
-		* This is the name of the edge. Currently its not implemented. This
-		* string could store data that identifies the edge. Could f.e. be the
-		* physical origin of the edge like : "tunneling", "spinflip",
-		* "relaxation", ...
-		*/
-		std::string Id;
-		
-		/**
-		* This is the "history" to the edge. The key-string in the map holds a
-		* timestamp and the double is the transitionProbabilitie at this time.
-		*/
-		std::map<std::string,double> rate;
+		return ColumnPointers[std::min<arma::uword>(j,ColumnPointers.size()-1)];
+	}
 
-		Edge(
-			State& p_targetState,
-			double p_transitionProbabilitie,
-			std::string id
-		):
-			targetState(p_targetState),
-			transitionProbabilitie(p_transitionProbabilitie),
-			Id(id)
-		{}
-		
-		/**
-		* When a State changes (f.e. due to the change of a voltage in the
-		* experiment or something) the edges, or more precisely their
-		* transition rates need to change. This method handles it. (This
-		* implies, that one has to overwrite the edges to represent every
-		* transition type in the system.)
-		*
-		* @param time The current time in the system.
-		*/
-		virtual void update(double time) = 0;
+	/**
+	* Writes the submatrix of the given sorted states in compressed sparse
+	* column format to rows, columns and values. See asSpMat.
+	*/
+	void collectSubMatrix(const std::vector<arma::uword>& states,bool normalised,std::vector<arma::uword>& rows,std::vector<arma::uword>& columns,std::vector<double>& values) const
+	{
+		const arma::uword none = std::numeric_limits<arma::uword>::max();
 
-		/**
-		* Outputs the values held in rate as a graphml snippet to the file.
-		*/
-		void writeToFile(std::ofstream& file,int indentTabs,int originState)
+		std::vector<arma::uword> position(Dimension,none);
+		for(arma::uword i = 0;i < states.size();i++)
 		{
-			std::string indent = "";
-			for(int i = 0;i<indentTabs;i++)
+			position[states[i]] = i;
+		}
+
+		columns.assign(1,0);
+
+		for(arma::uword j : states)
+		{
+			if(normalised)
 			{
-				indent += '\t';
+				rows.push_back(0);
+				values.push_back(1);
 			}
-			
-			file << indent << "<edge ";
-			file << "id=\"" << Id << "\" ";
-			file << "source=\"" << originState << "\" ";
-			file << "target=\"" << targetState.number() << "\">\n";
-			
-			for(auto pair : rate)
+
+			for(arma::uword k = columnBegin(j);k < columnBegin(j+1);k++)
 			{
-				file << indent << '\t' << "<data key=\"" << pair.first << "\">";
-				file << pair.second;
-				file << "</data>" << '\n';
+				arma::uword row = position[RowIndices[k]];
+
+				if(row != none && !(normalised && row == 0))
+				{
+					rows.push_back(row);
+					values.push_back(Values[k]);
+				}
 			}
 
-			file << indent << "</edge>\n";
+			columns.push_back(rows.size());
 		}
-	};
-	
+	}
+
+	public:
+
 	/**
-	* This class represents a state the quantumsystem can be found in. It
-	* simultaneously acts as a node in the Graph describing the Quantumsystem.
+	* Removes all columns and prepares the matrix for the assembly of a
+	* dimension x dimension matrix.
 	*/
-	class State
+	void reset(arma::uword dimension)
 	{
-		protected:
-		
-		/**
-		* This Variable is true if the transition probabilities for this State
-		* have been calculated before for some time.
-		*/
-		bool IsInitialized = false;
-		
-		/**
-		* The History of the Node is stored here. The Keys in this map, i.e. the
-		* strings are timestamps. The map holds the corresponding occupation
-		* values to the time that is encoded by the timestamp.
-		*/
-		std::map<std::string,double> Occupation;
-
-		/**
-		* Every state has a unique number. What the numbers physically mean is
-		* depends on the subclass of this class. important is that they reach
-		* from 0 to the number of possible states the system can be found in.
-		* <br>
-		* One Way to assign statenumbers is to number the energy levels in the
-		* system and sort them after their numbers. If we than use a 0 if the
-		* Level is not occupied in a given state and a 1 if its occupied we
-		* create a unique binary string that has a representation as decimal
-		* number for every state.
-		*/
-		int StateNumber;
-		
-		/**
-		* Every boolean in this array corresponds a level of the system. If the
-		* boolean is true, that means, that the level at the corresponding place in
-		* the levels array in the quantum system is occupied in this state. This
-		* variable can be used to identify states for some specific transitions.
-		*/
-		BinaryNumber OccupiedLevels;
-
-		/**
-		* The Possible transitions from this state to other states of the
-		* system.
-		*/
-		std::vector<Edge*> Edges;
-		
-		/**
-		* The systemtime which corresponds to the last calculation of the
-		* transitionprobabilities.
-		*/
-		double LastActualisation;
+		Dimension = dimension;
+		ColumnPointers.assign(1,0);
+		RowIndices.clear();
+		Values.clear();
+	}
 
-		public:
-		
-		State(
-			int p_stateNumber,
-			double initialTime,
-			int numberOfLevels
-		):
-			StateNumber(p_stateNumber),
-			OccupiedLevels(BinaryNumber(numberOfLevels,p_stateNumber)),
-			LastActualisation(initialTime)
-		{}
-		
-		~State()
+	/**
+	* Appends a column to the matrix. The columns have to be appended in the
+	* order of the state numbers. Columns that are skipped stay empty.
+	*
+	* @param column The number of the column, i.e. of the origin state.
+	* @param transitions The target state and the rate of every transition
+	* that leaves the state of this column. Transitions with the same target
+	* are summed up. The vector is sorted in place.
+	*/
+	void appendColumn(arma::uword column,std::vector<std::pair<arma::uword,double>>& transitions)
+	{
+		while(ColumnPointers.size()-1 < column)
 		{
-			for(Edge* e : Edges)
-			{
-				delete e;
-			}
+			ColumnPointers.push_back(RowIndices.size());
 		}
 
+		std::sort(transitions.begin(),transitions.end());
+
+		double pGo = 0;
+		bool diagonalWritten = false;
+
+		for(auto& t : transitions)
+		{
+			pGo -= t.second;
+		}
+
+		for(auto& t : transitions)
+		{
+			if(!diagonalWritten && t.first >= column)
+			{
+				RowIndices.push_back(column);
+				Values.push_back(pGo);
+				diagonalWritten = true;
+			}
+
+			if(t.first == column)
+			{
+				//A transition into the same state does not change anything.
+				Values.back() += t.second;
+				continue;
+			}
+
+			if(RowIndices.size() > ColumnPointers.back() && RowIndices.back() == t.first)
+			{
+				Values.back() += t.second;
+				continue;
+			}
+
+			RowIndices.push_back(t.first);
+			Values.push_back(t.second);
+		}
+
+		if(!diagonalWritten)
+		{
+			RowIndices.push_back(column);
+			Values.push_back(pGo);
+		}
+
+		ColumnPointers.push_back(RowIndices.size());
+	}
+
+	/**
+	* Overwrites the values of an existing column without changing the
+	* structure of the matrix.
+	*
+	* @param column The number of the column, i.e. of the origin state.
+	* @param transitions The target state and the rate of every transition
+	* that leaves the state of this column. The vector is sorted in place.
+	* @return false if a transition has a target that has no entry in the
+	* column. The column is left in an undefined state in this case and the
+	* matrix has to be assembled again.
+	*/
+	bool updateColumn(arma::uword column,std::vector<std::pair<arma::uword,double>>& transitions)
+	{
+		if(column+1 >= ColumnPointers.size())
+		{
+			return false;
+		}
+
+		arma::uword begin = ColumnPointers[column];
+		arma::uword end = ColumnPointers[column+1];
+
+		std::sort(transitions.begin(),transitions.end());
+
+		double pGo = 0;
+
+		for(arma::uword k = begin;k < end;k++)
+		{
+			Values[k] = 0;
+		}
+
+		arma::uword k = begin;
+
+		for(auto& t : transitions)
+		{
+			while(k < end && RowIndices[k] < t.first)
+			{
+				k++;
+			}
+
+			if(k == end || RowIndices[k] != t.first)
+			{
+				return false;
+			}
+
+			Values[k] += t.second;
+			pGo -= t.second;
+		}
+
+		auto diagonal = std::lower_bound(RowIndices.begin()+begin,RowIndices.begin()+end,column);
+
+		if(diagonal == RowIndices.begin()+end || *diagonal != column)
+		{
+			return false;
+		}
+
+		Values[diagonal-RowIndices.begin()] += pGo;
+
+		return true;
+	}
+
+	/**
+	* Calculates out = W*p.
+	*/
+	void multiply(const arma::Col<double>& p,arma::Col<double>& out) const
+	{
+		out.zeros(Dimension);
+
+		for(arma::uword j = 0;j < ColumnPointers.size()-1;j++)
+		{
+			double pj = p(j);
+
+			if(pj == 0)
+			{
+				continue;
+			}
+
+			for(arma::uword k = ColumnPointers[j];k < ColumnPointers[j+1];k++)
+			{
+				out(RowIndices[k]) += Values[k]*pj;
+			}
+		}
+	}
+
+	arma::Col<double> operator*(const arma::Col<double>& p) const
+	{
+		arma::Col<double> out;
+		multiply(p,out);
+		return out;
+	}
+
+	/**
+	* Returns true if both matrices store the same entries with the same
+	* values. Entries that were stored with the value zero count, so two
+	* equal matrices that were assembled differently may be unequal.
+	*/
+	bool operator==(const SparseMasterEquation& other) const
+	{
+		return Dimension == other.Dimension &&
+			ColumnPointers == other.ColumnPointers &&
+			RowIndices == other.RowIndices &&
+			Values == other.Values;
+	}
+
+	bool operator!=(const SparseMasterEquation& other) const
+	{
+		return !(*this == other);
+	}
+
+	/**
+	* Returns the largest rate at which a state is left, i.e. the largest
+	* absolute value on the diagonal. Since the columns sum up to zero, it
+	* is half the 1-norm of the matrix.
+	*/
+	double maximalEscapeRate() const
+	{
+		double toReturn = 0;
+
+		for(arma::uword j = 0;j+1 < ColumnPointers.size();j++)
+		{
+			for(arma::uword k = ColumnPointers[j];k < ColumnPointers[j+1];k++)
+			{
+				if(RowIndices[k] == j)
+				{
+					toReturn = std::max(toReturn,std::abs(Values[k]));
+				}
+			}
+		}
+
+		return toReturn;
+	}
+
+	/**
+	* Returns a copy of the matrix as dense armadillo matrix. This is meant
+	* for small systems and for solvers that need a dense factorisation.
+	*/
+	arma::Mat<double> asMat() const
+	{
+		arma::Mat<double> toReturn(Dimension,Dimension,arma::fill::zeros);
+
+		for(arma::uword j = 0;j+1 < ColumnPointers.size();j++)
+		{
+			for(arma::uword k = ColumnPointers[j];k < ColumnPointers[j+1];k++)
+			{
+				toReturn(RowIndices[k],j) = Values[k];
+			}
+		}
+
+		return toReturn;
+	}
+
+	/**
+	* Returns a copy of the matrix as armadillo sparse matrix. This is meant
+	* for solvers that need a factorisation or other operations that are
+	* provided by armadillo.
+	*/
+	arma::SpMat<double> asSpMat() const
+	{
+		arma::uvec rows(RowIndices.size());
+		arma::uvec columns(Dimension+1);
+		arma::Col<double> values(Values.size());
+
+		for(arma::uword k = 0;k < RowIndices.size();k++)
+		{
+			rows(k) = RowIndices[k];
+			values(k) = Values[k];
+		}
+
+		for(arma::uword j = 0;j <= Dimension;j++)
+		{
+			columns(j) = ColumnPointers[std::min<arma::uword>(j,ColumnPointers.size()-1)];
+		}
+
+		return arma::SpMat<double>(rows,columns,values,Dimension,Dimension);
+	}
+
+	/**
+	* Returns the submatrix of the given states as armadillo sparse matrix.
+	* The states have to be sorted. If normalised is true, the first row is
+	* replaced by ones, which turns the singular system W*p = 0 of a closed
+	* class into one with the additional condition sum(p) = 1.
+	*/
+	arma::SpMat<double> asSpMat(const std::vector<arma::uword>& states,bool normalised) const
+	{
+		std::vector<arma::uword> rows;
+		std::vector<arma::uword> columns;
+		std::vector<double> values;
+		collectSubMatrix(states,normalised,rows,columns,values);
+
+		return arma::SpMat<double>(arma::uvec(rows),arma::uvec(columns),arma::Col<double>(values),states.size(),states.size());
+	}
+
+	/**
+	* Returns the submatrix of the given states as dense armadillo matrix.
+	* See asSpMat.
+	*/
+	arma::Mat<double> asMat(const std::vector<arma::uword>& states,bool normalised) const
+	{
+		std::vector<arma::uword> rows;
+		std::vector<arma::uword> columns;
+		std::vector<double> values;
+		collectSubMatrix(states,normalised,rows,columns,values);
+
+		arma::Mat<double> toReturn(states.size(),states.size(),arma::fill::zeros);
+
+		for(arma::uword j = 0;j < states.size();j++)
+		{
+			for(arma::uword k = columns[j];k < columns[j+1];k++)
+			{
+				toReturn(rows[k],j) = values[k];
+			}
+		}
+
+		return toReturn;
+	}
+
+	/**
+	* Returns the closed classes of the transition graph: the sets of states
+	* that are connected with each other by transitions in both directions
+	* and have no transition to a state outside of the set. Every closed
+	* class has exactly one stationary distribution. All other states are
+	* transient, their occupation eventually ends up in the closed classes.
+	* The states of every class are sorted.
+	*/
+	std::vector<std::vector<arma::uword>> closedClasses() const
+	{
+		//Tarjans algorithm for the strongly connected components, without
+		//recursion to handle large systems.
+		const arma::uword none = std::numeric_limits<arma::uword>::max();
+
+		std::vector<arma::uword> index(Dimension,none);
+		std::vector<arma::uword> lowLink(Dimension,0);
+		std::vector<arma::uword> component(Dimension,none);
+		std::vector<bool> onStack(Dimension,false);
+		std::vector<arma::uword> stack;
+		std::vector<std::pair<arma::uword,arma::uword>> path;
+		std::vector<std::vector<arma::uword>> components;
+		arma::uword counter = 0;
+
+		auto visit = [&](arma::uword v)
+		{
+			index[v] = counter;
+			lowLink[v] = counter;
+			counter++;
+			stack.push_back(v);
+			onStack[v] = true;
+			path.push_back({v,columnBegin(v)});
+		};
+
+		for(arma::uword root = 0;root < Dimension;root++)
+		{
+			if(index[root] != none)
+			{
+				continue;
+			}
+
+			visit(root);
+
+			while(!path.empty())
+			{
+				arma::uword v = path.back().first;
+				arma::uword k = path.back().second;
+
+				if(k < columnBegin(v+1))
+				{
+					path.back().second++;
+
+					arma::uword w = RowIndices[k];
+					if(w == v || Values[k] <= 0)
+					{
+						continue;
+					}
+
+					if(index[w] == none)
+					{
+						visit(w);
+					}
+					else if(onStack[w])
+					{
+						lowLink[v] = std::min(lowLink[v],index[w]);
+					}
+
+					continue;
+				}
+
+				path.pop_back();
+				if(!path.empty())
+				{
+					arma::uword parent = path.back().first;
+					lowLink[parent] = std::min(lowLink[parent],lowLink[v]);
+				}
+
+				if(lowLink[v] == index[v])
+				{
+					components.emplace_back();
+					arma::uword w;
+					do
+					{
+						w = stack.back();
+						stack.pop_back();
+						onStack[w] = false;
+						component[w] = components.size()-1;
+						components.back().push_back(w);
+					}
+					while(w != v);
+				}
+			}
+		}
+
+		std::vector<bool> closed(components.size(),true);
+		for(arma::uword j = 0;j < Dimension;j++)
+		{
+			for(arma::uword k = columnBegin(j);k < columnBegin(j+1);k++)
+			{
+				if(Values[k] > 0 && component[RowIndices[k]] != component[j])
+				{
+					closed[component[j]] = false;
+				}
+			}
+		}
+
+		std::vector<std::vector<arma::uword>> toReturn;
+		for(std::size_t c = 0;c < components.size();c++)
+		{
+			if(closed[c])
+			{
+				std::sort(components[c].begin(),components[c].end());
+				toReturn.push_back(std::move(components[c]));
+			}
+		}
+
+		return toReturn;
+	}
+
+	/**
+	* Returns the number of rows and columns.
+	*/
+	arma::uword dimension() const
+	{
+		return Dimension;
+	}
+
+	/**
+	* Returns the number of stored entries.
+	*/
+	arma::uword nonZeros() const
+	{
+		return Values.size();
+	}
+
+	/**
+	* Returns the number of bytes allocated for the matrix.
+	*/
+	std::size_t memoryFootprint() const
+	{
+		return (ColumnPointers.capacity() + RowIndices.capacity())*sizeof(arma::uword) + Values.capacity()*sizeof(double);
+	}
+};
+
+/**
+* A matrix free representation of the masterequation. It uses that the states
+* of a system are the corners of a hypercube: Every transition flips a fixed
+* set of bits of the state number, f.e. one bit for tunneling in or out of a
+* level or two bits for a spin flip between two levels. This set of bits is
+* called the mask of the transition.<br>
+* Every transition pairs its origin with the state that differs by the mask,
+* so both directions between the two states share one entry. For every mask
+* only the pairs that have a transition are stored, so the memory grows with
+* the number of transitions and not with the number of possible states.
+* Applying the masterequation then walks the pairs of every mask and moves
+* the flow between the two states of each pair. The diagonal of the matrix is
+* never stored.
+*/
+class HypercubeMasterEquation
+{
+	public:
+
+	/**
+	* The position of one rate, see slot. A mask of none marks a transition
+	* of a state to itself, which has no rate.
+	*/
+	struct Slot
+	{
+		static constexpr std::size_t none = std::numeric_limits<std::size_t>::max();
+
+		std::size_t Mask = none;
+		std::size_t Rate = 0;
+	};
+
+	protected:
+
+	/**
+	* The pairs of one mask.
+	*/
+	struct MaskRates
+	{
+		arma::uword Mask;
+
+		/**
+		* The state of every pair where the highest bit of the mask is zero.
+		* The other state of the pair is Lower[i]^Mask.
+		*/
+		std::vector<arma::uword> Lower;
+
+		/**
+		* Two rates per pair: Rates[2*i] is the rate from Lower[i] to the
+		* other state, Rates[2*i+1] the rate back.
+		*/
+		std::vector<double> Rates;
+
+		/**
+		* Maps the lower state of a pair to its index.
+		*/
+		std::unordered_map<arma::uword,std::size_t> PairOfLower;
+	};
+
+	/**
+	* The number of states.
+	*/
+	arma::uword Dimension = 0;
+
+	std::vector<MaskRates> Masks;
+
+	/**
+	* Maps a mask to its index in Masks.
+	*/
+	std::unordered_map<arma::uword,std::size_t> MaskIndex;
+
+	/**
+	* Returns the pairs of the given mask. They are created if the mask is
+	* not known yet.
+	*/
+	std::size_t indexOfMask(arma::uword mask)
+	{
+		auto found = MaskIndex.find(mask);
+		if(found != MaskIndex.end())
+		{
+			return found->second;
+		}
+
+		MaskIndex.insert({mask,Masks.size()});
+		Masks.push_back(MaskRates());
+		Masks.back().Mask = mask;
+
+		return Masks.size()-1;
+	}
+
+	public:
+
+	/**
+	* Removes all rates and prepares the kernel for a system with the given
+	* number of states. The number of states has to be a power of two.
+	*/
+	void reset(arma::uword dimension)
+	{
+		Dimension = dimension;
+		Masks.clear();
+		MaskIndex.clear();
+	}
+
+	/**
+	* Returns the position of the rate of the transition from the state
+	* origin to the state origin^mask. The pair is created with the rate 0 in
+	* both directions if it does not exist yet. The position stays valid until
+	* reset is called, so a caller that sets the same rates again and again
+	* can look them up once. A mask of 0 is a transition of a state to itself.
+	* It cancels out of the master equation and gets no rate.
+	*/
+	Slot slot(arma::uword mask,arma::uword origin)
+	{
+		Slot toReturn;
+
+		if(mask == 0)
+		{
+			return toReturn;
+		}
+
+		toReturn.Mask = indexOfMask(mask);
+		MaskRates& m = Masks[toReturn.Mask];
+
+		//The highest bit of the mask decides which state is the lower one.
+		arma::uword high = mask;
+		while(high & (high-1))
+		{
+			high &= high-1;
+		}
+		arma::uword lower = (origin & high) ? origin^mask : origin;
+
+		auto found = m.PairOfLower.find(lower);
+		if(found == m.PairOfLower.end())
+		{
+			found = m.PairOfLower.insert({lower,m.Lower.size()}).first;
+			m.Lower.push_back(lower);
+			m.Rates.push_back(0);
+			m.Rates.push_back(0);
+		}
+
+		toReturn.Rate = 2*found->second + (origin == lower ? 0 : 1);
+
+		return toReturn;
+	}
+
+	/**
+	* Sets the rate at a position returned by slot.
+	*/
+	void setRate(const Slot& s,double rate)
+	{
+		if(s.Mask != Slot::none)
+		{
+			Masks[s.Mask].Rates[s.Rate] = rate;
+		}
+	}
+
+	/**
+	* Adds to the rate at a position returned by slot.
+	*/
+	void addRate(const Slot& s,double rate)
+	{
+		if(s.Mask != Slot::none)
+		{
+			Masks[s.Mask].Rates[s.Rate] += rate;
+		}
+	}
+
+	/**
+	* Sets the rate of the transition from the state origin to the state
+	* origin^mask. A mask of 0 is ignored, see slot.
+	*/
+	void setRate(arma::uword mask,arma::uword origin,double rate)
+	{
+		setRate(slot(mask,origin),rate);
+	}
+
+	/**
+	* Adds to the rate of the transition from the state origin to the state
+	* origin^mask. A mask of 0 is ignored, see slot.
+	*/
+	void addRate(arma::uword mask,arma::uword origin,double rate)
+	{
+		addRate(slot(mask,origin),rate);
+	}
+
+	/**
+	* Calculates out = W*p without building W.
+	*/
+	void multiply(const arma::Col<double>& p,arma::Col<double>& out) const
+	{
+		out.zeros(Dimension);
+
+		const double* pp = p.memptr();
+		double* o = out.memptr();
+
+		for(const MaskRates& m : Masks)
+		{
+			const arma::uword* lower = m.Lower.data();
+			const double* r = m.Rates.data();
+
+			for(std::size_t i = 0;i < m.Lower.size();i++)
+			{
+				arma::uword a = lower[i];
+				arma::uword b = a^m.Mask;
+
+				double flow = r[2*i]*pp[a] - r[2*i+1]*pp[b];
+				o[a] -= flow;
+				o[b] += flow;
+			}
+		}
+	}
+
+	arma::Col<double> operator*(const arma::Col<double>& p) const
+	{
+		arma::Col<double> out;
+		multiply(p,out);
+		return out;
+	}
+
+	/**
+	* Returns the number of states.
+	*/
+	arma::uword dimension() const
+	{
+		return Dimension;
+	}
+
+	/**
+	* Returns the number of different masks.
+	*/
+	arma::uword numberOfMasks() const
+	{
+		return Masks.size();
+	}
+
+	/**
+	* Returns the number of bytes allocated for the rates. The nodes of the
+	* hash maps are counted with the size of their value.
+	*/
+	std::size_t memoryFootprint() const
+	{
+		std::size_t bytes = Masks.capacity()*sizeof(MaskRates) + MaskIndex.size()*sizeof(std::pair<arma::uword,std::size_t>);
+
+		for(const MaskRates& m : Masks)
+		{
+			bytes += m.Lower.capacity()*sizeof(arma::uword) + m.Rates.capacity()*sizeof(double);
+			bytes += m.PairOfLower.bucket_count()*sizeof(void*) + m.PairOfLower.size()*sizeof(std::pair<arma::uword,std::size_t>);
+		}
+
+		return bytes;
+	}
+};
+
+/**
+* A first order ODE dx/dt = f(t,x). The numerical schemes only need this
+* interface, so they can integrate a whole QuantumSystem as well as parts of
+* it.
+*/
+class DifferentialEquation
+{
+	public:
+
+	virtual ~DifferentialEquation() {}
+
+	/**
+	* Writes the derivative f(time,probabilities) to derivative. derivative
+	* gets the size of probabilities. If it has this size already, no memory
+	* is allocated, so the solvers can call this in every step without
+	* allocations.
+	*/
+	virtual void ODE(double time,const arma::Col<double>& probabilities,arma::Col<double>& derivative)=0;
+
+	/**
+	* Returns the derivative f(time,probabilities) as new vector.
+	*/
+	arma::Col<double> ODE(double time,const arma::Col<double>& probabilities)
+	{
+		arma::Col<double> derivative;
+		ODE(time,probabilities,derivative);
+		return derivative;
+	}
+};
+
+/**
+* This Class represents a Quantumsystem with discrete finite states. It
+* encapsulates all the physics that make up the System. The System is Stored as
+* a Graph. The Nodes in the graph are the states the system can be in. The edges
+* are the different transitions that can occur. The weight of the edges is the
+* probability that a transition occurs in a Unit time.<br>
+* This Class handles all access on the physical parameters of the system, be it
+* the request of a masterequation or transition probabilities for single states.
+* This way, the QuantumSystem object can keep Track of the access and can create
+* a "on the fly" look-up-table so that already known physical data must not be
+* computed twice. This way, assuming the evaluation of the physical equations
+* describing the system is expensive, runtime can be saved. This assumption
+* seems legit, since most of the time one is dealing with exponentials when
+* describing quantum Systems. Rates that are the same in many systems, f.e.
+* in a sweep, can be shared between systems with a RateCache (see
+* rate_cache_code.cpp) that is queried in createEdges or Edge::update.<br>
+* All concrete quantum Systems should be subclasses of this abstract base. All
+* solvers should be implemented using the abstract base. This way, it is save,
+* that they all can operate on every Quantumsystem that is described using this
+* library.<br>
+* The informations about the physics of the System are strored in the Graph,
+* representing the system and its dynamics. A subclass must override the actualisationNeedet
+* and the calculateProbabilities functions. The first of which is checking if
+* the transition probabilities for a given state at a given time should be
+* calculated. The second adds the edges to the graph.
+* This class also saves the state of the System i.e. the occupation of the
+* states and the transition probabilities at a given time. It can write this
+* data to a graphml file. 
+*/
+class QuantumSystem : public DifferentialEquation
+{
+	public:
+
+	/**
+	* The file formats the system can be saved in (see writeToFile).
+	*/
+	enum class OutputFormat
+	{
+		GraphML,
+		Binary
+	};
+
+	protected:
+
+	class State;
+
+	/**
+	* The values of a node or an edge on the keyframes. The values are stored
+	* in one contiguous array, indexed by the number of the keyframe. A node or
+	* edge that was created after the first keyframe starts its history at
+	* FirstKeyframe.
+	*/
+	struct KeyframeHistory
+	{
+		/**
+		* The number of the keyframe of Values[0].
+		*/
+		std::size_t FirstKeyframe = 0;
+
+		std::vector<double> Values;
+
+		/**
+		* Appends the value of the given keyframe.
+		*
+		* @param expectedKeyframes The number of keyframes the solver will
+		* log. It is used to allocate the array once.
+		*/
+		void log(std::size_t keyframe,double value,std::size_t expectedKeyframes)
+		{
+			if(Values.empty())
+			{
+				FirstKeyframe = keyframe;
+				if(expectedKeyframes > keyframe)
+				{
+					Values.reserve(expectedKeyframes-keyframe);
+				}
+			}
+
+			Values.push_back(value);
+		}
+
+		/**
+		* Returns the value of the given keyframe or NaN if it was not logged.
+		*/
+		double at(std::size_t keyframe) const
+		{
+			if(keyframe < FirstKeyframe || keyframe - FirstKeyframe >= Values.size())
+			{
+				return std::numeric_limits<double>::quiet_NaN();
+			}
+
+			return Values[keyframe - FirstKeyframe];
+		}
+
+		/**
+		* Returns the number of bytes allocated for the values.
+		*/
+		std::size_t memoryFootprint() const
+		{
+			return Values.capacity()*sizeof(double);
+		}
+
+		/**
+		* Writes one data element per keyframe.
+		*
+		* @param dataKeys The id of the data key of every keyframe.
+		*/
+		void writeToFile(std::ofstream& file,const std::string& indent,const std::vector<std::string>& dataKeys) const
+		{
+			for(std::size_t k = 0;k < Values.size();k++)
+			{
+				file << indent << "<data key=\"" << dataKeys[FirstKeyframe+k] << "\">";
+				file << Values[k];
+				file << "</data>" << '\n';
+			}
+		}
+	};
+	
+	/*
+	* This Class represents a (directed) edge in the Graph describing the physics of this
+	* quantumsystem. 
+	*/	
+	struct Edge
+	{
+		/**
+		* The State on which the edge is pointing. This is the endstate of the
+		* transition the edge is symbolizing.
+		*/
+		State& targetState;
+		
+		/**
+		* The Probability that the Transition the Edge is Symbolizing is
+		* occurring.
+		*/
+		double transitionProbabilitie;
+		
+		/**
+		* This is the name of the edge. This string could store data that
+		* identifies the edge. Could f.e. be the physical origin of the edge
+		* like : "tunneling", "spinflip", "relaxation", ... Edges with the same
+		* Id are stored in the same group of the EdgeTable and can be updated
+		* together (see updateEdgeGroup).
+		*/
+		std::string Id;
+
+		/**
+		* The index of the group of this edge in the EdgeTable and the
+		* position of the edge inside the group.
+		*/
+		std::size_t Group = 0;
+		std::size_t PositionInGroup = 0;
+		
+		/**
+		* This is the "history" to the edge. It holds the
+		* transitionProbabilitie on every keyframe.
+		*/
+		KeyframeHistory rate;
+
+		Edge(
+			State& p_targetState,
+			double p_transitionProbabilitie,
+			std::string id
+		):
+			targetState(p_targetState),
+			transitionProbabilitie(p_transitionProbabilitie),
+			Id(id)
+		{}
+
+		virtual ~Edge() {}
+		
+		/**
+		* When a State changes (f.e. due to the change of a voltage in the
+		* experiment or something) the edges, or more precisely their
+		* transition rates need to change. This method handles it. (This
+		* implies, that one has to overwrite the edges to represent every
+		* transition type in the system.)<br>
+		* A SectorSolver with several threads calls this method for edges of
+		* different states at the same time, so it must only read data that
+		* is shared between the edges.
+		*
+		* @param time The current time in the system.
+		*/
+		virtual void update(double time) = 0;
+
+		/**
+		* Outputs the values held in rate as a graphml snippet to the file.
+		*
+		* @param dataKeys The id of the data key of every keyframe.
+		*/
+		void writeToFile(std::ofstream& file,int indentTabs,int originState,const std::vector<std::string>& dataKeys)
+		{
+			writeToFile(file,indentTabs,originState,dataKeys,rate);
+		}
+
+		/**
+		* Writes the edge with the values of the given history instead of
+		* the own one. It is used if the keyframes were streamed to a file.
+		*/
+		void writeToFile(std::ofstream& file,int indentTabs,int originState,const std::vector<std::string>& dataKeys,const KeyframeHistory& values)
+		{
+			std::string indent = "";
+			for(int i = 0;i<indentTabs;i++)
+			{
+				indent += '\t';
+			}
+			
+			file << indent << "<edge ";
+			file << "id=\"" << Id << "\" ";
+			file << "source=\"" << originState << "\" ";
+			file << "target=\"" << targetState.number() << "\">\n";
+			
+			values.writeToFile(file,indent+'\t',dataKeys);
+
+			file << indent << "</edge>\n";
+		}
+	};
+	
+	/**
+	* This class represents a state the quantumsystem can be found in. It
+	* simultaneously acts as a node in the Graph describing the Quantumsystem.
+	*/
+	class State
+	{
+		protected:
+		
+		/**
+		* This Variable is true if the transition probabilities for this State
+		* have been calculated before for some time.
+		*/
+		bool IsInitialized = false;
+
+		/**
+		* This Variable is true if edges were added to this state or the
+		* transition probabilities of its edges were actualized since the
+		* masterequation was assembled the last time.
+		*/
+		bool RatesChanged = false;
+
+		/**
+		* Is increased whenever RatesChanged is set. Unlike RatesChanged it
+		* is never reset, so several users can find out independently
+		* whether the edges changed since they last looked.
+		*/
+		std::size_t RatesVersion = 0;
+		
+		/**
+		* The History of the Node is stored here. It holds the occupation on
+		* every keyframe.
+		*/
+		KeyframeHistory Occupation;
+
+		/**
+		* Every state has a unique number. What the numbers physically mean is
+		* depends on the subclass of this class. important is that they reach
+		* from 0 to the number of possible states the system can be found in.
+		* <br>
+		* One Way to assign statenumbers is to number the energy levels in the
+		* system and sort them after their numbers. If we than use a 0 if the
+		* Level is not occupied in a given state and a 1 if its occupied we
+		* create a unique binary string that has a representation as decimal
+		* number for every state.
+		*/
+		std::size_t StateNumber;
+		
+		/**
+		* Every boolean in this array corresponds a level of the system. If the
+		* boolean is true, that means, that the level at the corresponding place in
+		* the levels array in the quantum system is occupied in this state. This
+		* variable can be used to identify states for some specific transitions.
+		*/
+		BinaryNumber OccupiedLevels;
+
+		/**
+		* The Possible transitions from this state to other states of the
+		* system.
+		*/
+		std::vector<Edge*> Edges;
+		
+		/**
+		* The systemtime which corresponds to the last calculation of the
+		* transitionprobabilities.
+		*/
+		double LastActualisation;
+
+		/**
+		* The index of the first edge of this state in
+		* QuantumSystem::EdgeSlots. The edges of a state have consecutive
+		* slots.
+		*/
+		std::size_t FirstEdgeSlot = 0;
+
+		public:
+		
+		State(
+			std::size_t p_stateNumber,
+			double initialTime,
+			int numberOfLevels
+		):
+			StateNumber(p_stateNumber),
+			OccupiedLevels(BinaryNumber(numberOfLevels,p_stateNumber)),
+			LastActualisation(initialTime)
+		{}
+		
+		~State()
+		{
+			for(Edge* e : Edges)
+			{
+				delete e;
+			}
+		}
+
+		/**
+		* This method is used by the QuantumSystem to store the calculated edges
+		* on actualisation of this node.
+		*
+		* @param time The in simulation time that corresponds to the transitions
+		* and probabilities.
+		* @param newEdges The edges encoding the transitions that are set to the
+		* state. 
+		*/
+		void storeEdges(double time,std::vector<Edge*>& newEdges)
+		{
+			for(Edge* e : newEdges)
+			{
+				Edges.push_back(e);
+			}
+
+			LastActualisation = time;
+			IsInitialized=true;
+			RatesChanged=true;
+			RatesVersion++;
+		}
+		
+		/**
+		* Returns the time value where the last actualisation of the
+		* edge-transition values for the edges that point away from this point
+		* occured.
+		*/
+		double lastActualisation()
+		{
+			return LastActualisation;
+		}
+		
+		/**
+		* Returns the edges that point away from this node.
+		*/
+		std::vector<Edge*>& edges()
+		{
+			return Edges;
+		}
+		
+		/**
+		* Is used by the quantumsystem to automatically log the time by which
+		* the state was actualized.
+		*/
+		void setLastActualisation(double time)
+		{
+			LastActualisation = time;
+		}
+
+		/**
+		* Is used by the QuantumSystem to store where the edges of this
+		* state are found in its EdgeTable.
+		*/
+		void setFirstEdgeSlot(std::size_t slot)
+		{
+			FirstEdgeSlot = slot;
+		}
+
+		std::size_t firstEdgeSlot()
+		{
+			return FirstEdgeSlot;
+		}
+
+		/**
+		* returns the statenumber, i.e. the identifier of this state.
+		*/
+		std::size_t number()
+		{
+			return StateNumber;
+		}
+		
+		/**
+		* Returns the occupied levels variable. With this it should be easier to
+		* create the edges. The copy is cheap since BinaryNumber is only an
+		* integer.
+		*/
+		BinaryNumber occupiedLevels() const
+		{
+			return OccupiedLevels;
+		}
+
+		/**
+		* Saves the given occupation value to the Occupation history. This
+		* Method is used by the solver to save the state of the system for a
+		* given keyframe.
+		*/
+		void logOccupation(std::size_t keyframe,double occ,std::size_t expectedKeyframes)
+		{
+			Occupation.log(keyframe,occ,expectedKeyframes);
+		}
+
+		/**
+		* Returns the history of the occupation.
+		*/
+		const KeyframeHistory& occupation() const
+		{
+			return Occupation;
+		}
+
+		/**
+		* Returns the number of bytes the state, its history and its edges
+		* use. Edges are counted with the size of the Edge class, the members
+		* of subclasses are not counted.
+		*/
+		std::size_t memoryFootprint() const
+		{
+			std::size_t bytes = sizeof(State) + Occupation.memoryFootprint() + Edges.capacity()*sizeof(Edge*);
+
+			for(Edge* e : Edges)
+			{
+				bytes += sizeof(Edge) + e->Id.capacity() + e->rate.memoryFootprint();
+			}
+
+			return bytes;
+		}
+		
+		/**
+		* Outputs the Occupation and other parameters that make up this node as
+		* graphml snippet.
+		*
+		* @param dataKeys The id of the data key of every keyframe.
+		*/
+		void writeToFile(std::ofstream& file,int indentTabs,const std::vector<std::string>& dataKeys)
+		{
+			writeToFile(file,indentTabs,dataKeys,Occupation);
+		}
+
+		/**
+		* Writes the node with the values of the given history instead of
+		* the own one. It is used if the keyframes were streamed to a file.
+		*/
+		void writeToFile(std::ofstream& file,int indentTabs,const std::vector<std::string>& dataKeys,const KeyframeHistory& values)
+		{
+			std::string indent = "";
+			for(int i = 0;i<indentTabs;i++)
+			{
+				indent += '\t';
+			}
+			file << indent <<	"<node id=\"" << StateNumber << "\">" << "\n";
+			
+			values.writeToFile(file,indent+'\t',dataKeys);
+			file << indent <<	"</node>" << "\n";
+
+		}
+
+		/**
+		* Returns the initialisation status of the node. Initialized means that
+		* all the edges are generated and their transition probabilities are
+		* calculated. The method is used by the Quantumsystem to keep track of
+		* the calculated values.
+		*/
+		bool isInitialized()
+		{
+			return IsInitialized;
+		}
+
+		/**
+		* Returns true if the edges of this state changed since the last call
+		* of clearRatesChanged. It is used by the QuantumSystem to only
+		* rewrite the parts of the masterequation that changed.
+		*/
+		bool ratesChanged()
+		{
+			return RatesChanged;
+		}
+
+		/**
+		* Is used by the QuantumSystem to mark the edges of this state as
+		* written to the masterequation.
+		*/
+		void clearRatesChanged()
+		{
+			RatesChanged = false;
+		}
+
+		/**
+		* Is used by the QuantumSystem to mark the edges of this state as
+		* actualized.
+		*/
+		void markRatesChanged()
+		{
+			RatesChanged = true;
+			RatesVersion++;
+		}
+
+		/**
+		* Returns a number that changes whenever the edges of this state
+		* change.
+		*/
+		std::size_t ratesVersion()
+		{
+			return RatesVersion;
+		}
+
+	};
+	
+	/**
+	* The lookup-table of the states. A State is only created when it is
+	* accessed the first time, so constructing a QuantumSystem costs almost
+	* nothing. The states are found by their number in a hash map, so states
+	* that are never created cost no memory.<br>
+	* Iterating over the table visits every state of the system and creates
+	* the missing ones, unless visitOnlyCreatedStates was called. Then only
+	* the states that were created before are visited.
+	*/
+	class StateTable
+	{
+		protected:
+
+		int NumberOfLevels;
+
+		double InitialTime;
+
+		/**
+		* The created states, found by their number. A state that is never
+		* created costs nothing.
+		*/
+		std::unordered_map<std::size_t,std::unique_ptr<State>> States;
+
+		/**
+		* The created states in the order of their creation. Iterations over
+		* the created states sort it by the state number first.
+		*/
+		std::vector<State*> Created;
+
+		bool CreatedSorted = true;
+
+		bool VisitAllStates = true;
+
+		void sortCreated()
+		{
+			if(!CreatedSorted)
+			{
+				std::sort(Created.begin(),Created.end(),[](State* a,State* b){return a->number() < b->number();});
+				CreatedSorted = true;
+			}
+		}
+
+		public:
+
+		/**
+		* Visits the numbers 0 to size()-1 and creates the missing states,
+		* or, after visitOnlyCreatedStates, the created states in ascending
+		* order. States that are created during such an iteration are not
+		* visited by it.
+		*/
+		class iterator
+		{
+			StateTable* Table;
+			std::size_t Index;
+
+			public:
+
+			iterator(StateTable* table,std::size_t index):
+				Table(table),
+				Index(index)
+			{}
+
+			State& operator*()
+			{
+				if(Table->VisitAllStates)
+				{
+					return (*Table)[Index];
+				}
+
+				return *Table->Created[Index];
+			}
+
+			iterator& operator++()
+			{
+				Index++;
+				return *this;
+			}
+
+			bool operator!=(const iterator& other) const
+			{
+				return Index != other.Index;
+			}
+		};
+
+		StateTable(int numberOfLevels,double initialTime):
+			NumberOfLevels(numberOfLevels),
+			InitialTime(initialTime)
+		{
+			//The state numbers have to fit into a std::size_t.
+			if(numberOfLevels < 0 || numberOfLevels >= std::numeric_limits<std::size_t>::digits)
+			{
+				throw std::runtime_error("A QuantumSystem can have at most "+std::to_string(std::numeric_limits<std::size_t>::digits-1)+" levels.");
+			}
+		}
+
+		/**
+		* Returns the state with the given number and creates it if it does
+		* not exist yet.
+		*/
+		State& operator[](std::size_t number)
+		{
+			//find does not change the map, so several threads may look up
+			//created states at the same time (see QuantumSystem::Sector).
+			auto found = States.find(number);
+			if(found != States.end())
+			{
+				return *found->second;
+			}
+
+			State* s = new State(number,InitialTime,NumberOfLevels);
+			States[number].reset(s);
+
+			if(!Created.empty() && Created.back()->number() > number)
+			{
+				CreatedSorted = false;
+			}
+			Created.push_back(s);
+
+			return *s;
+		}
+
+		/**
+		* Returns the number of bytes of the created states and the table.
+		* The nodes of the hash map are counted with the size of their value.
+		*/
+		std::size_t memoryFootprint() const
+		{
+			std::size_t bytes = States.bucket_count()*sizeof(void*) + States.size()*sizeof(std::pair<std::size_t,std::unique_ptr<State>>) + Created.capacity()*sizeof(State*);
+
+			for(State* s : Created)
+			{
+				bytes += s->memoryFootprint();
+			}
+
+			return bytes;
+		}
+
+		/**
+		* Returns true if the state with the given number was created.
+		*/
+		bool isCreated(std::size_t number) const
+		{
+			return States.count(number) != 0;
+		}
+
+		/**
+		* Returns the created states in ascending order of their numbers.
+		*/
+		const std::vector<State*>& createdStates()
+		{
+			sortCreated();
+			return Created;
+		}
+
+		/**
+		* Returns the number of states the system can be found in. This
+		* includes the states that are not created.
+		*/
+		std::size_t size() const
+		{
+			return std::size_t(1) << NumberOfLevels;
+		}
+
+		/**
+		* After this call iterations only visit the states that were created
+		* before.
+		*/
+		void visitOnlyCreatedStates()
+		{
+			VisitAllStates = false;
+		}
+
+		iterator begin()
+		{
+			sortCreated();
+			return iterator(this,0);
+		}
+
+		iterator end()
+		{
+			return iterator(this,VisitAllStates ? size() : Created.size());
+		}
+	};
+
+	/**
+	* This table holds all States the system can be found in. It is used as a
+	* lookup-table.
+	*/
+	StateTable allStates;
+
+	/**
+	* The states with a nonzero initial occupation if only the reachable
+	* states should be created. See useReachableStatesOnly.
+	*/
+	std::vector<std::size_t> ReachableStatesSeeds;
+
+	/**
+	* Creates the states that can be reached from ReachableStatesSeeds with a
+	* breadth first search over the edges. Afterwards only these states are
+	* part of the masterequation. Does nothing if useReachableStatesOnly was
+	* not called or the search was done before.
+	*/
+	void createReachableStates(double time)
+	{
+		if(ReachableStatesSeeds.empty())
+		{
+			return;
+		}
+
+		std::deque<std::size_t> pending(ReachableStatesSeeds.begin(),ReachableStatesSeeds.end());
+		ReachableStatesSeeds.clear();
+
+		while(!pending.empty())
+		{
+			State& s = allStates[pending.front()];
+			pending.pop_front();
+
+			if(s.isInitialized())
+			{
+				continue;
+			}
+
+			for(Edge* e : getProbabilities(time,s))
+			{
+				if(!e->targetState.isInitialized())
+				{
+					pending.push_back(e->targetState.number());
+				}
+			}
+		}
+
+		allStates.visitOnlyCreatedStates();
+	}
+	
+	/**
+	* This method should return true if the probabilities of a state should be
+	* actualized at a given time. Therefore it can compare the last
+	* actualisation time of the state, which corresponds to the states values
+	* with the time given. 
+	* Note that is must not check if the state is initilised or not since this
+	* check is already been done at the point this method is called.
+	* Also see getProbabilities.
+	*/
+	virtual bool actualisationNeedet(double time,State& s)=0;
+	
+	/**
+	* This method creates all edges and initializes their transition values. It
+	* is used to initialize a state.
+	*/	
+	virtual void createEdges(double time,State& s)=0;
+
+	/**
+	* All edges of one physical type, i.e. with the same Edge::Id, stored in
+	* contiguous arrays. Entry i of every array belongs to the same edge.
+	*/
+	struct EdgeGroup
+	{
+		/**
+		* The Id of the edges in this group.
+		*/
+		std::string Type;
+
+		/**
+		* The numbers of the origin and target states of the edges.
+		*/
+		std::vector<std::size_t> Source;
+		std::vector<std::size_t> Target;
+
+		/**
+		* The transition rates. updateEdgeGroup writes the new rates here.
+		* Rates calculated with Edge::update are copied here as well, so the
+		* assembly of the masterequation reads all rates from these arrays.
+		*/
+		std::vector<double> Rate;
+
+		/**
+		* The edge objects that belong to the entries. They are kept up to
+		* date with Rate after every batched update. They are only needed
+		* for Edge::update and for the output.
+		*/
+		std::vector<Edge*> Edges;
+
 		/**
-		* This method is used by the QuantumSystem to store the calculated edges
-		* on actualisation of this node.
-		*
-		* @param time The in simulation time that corresponds to the transitions
-		* and probabilities.
-		* @param newEdges The edges encoding the transitions that are set to the
-		* state. 
+		* False once updateEdgeGroup reported that it can not update this
+		* group. The edges are then updated one by one with Edge::update.
 		*/
-		void storeEdges(double time,std::vector<Edge*>& newEdges)
+		bool Batched = true;
+
+		/**
+		* True if an edge of this group has to be actualized.
+		*/
+		bool Pending = false;
+
+		/**
+		* The edges that have to be actualized, used if the batched update
+		* turns out to be not available.
+		*/
+		std::vector<Edge*> PendingEdges;
+	};
+
+	/**
+	* The flat table of all edges of the system, grouped by their type.
+	*/
+	std::vector<EdgeGroup> EdgeTable;
+
+	/**
+	* Maps the type of an edge to its group in EdgeTable.
+	*/
+	std::map<std::string,std::size_t> EdgeGroupOfType;
+
+	/**
+	* The group and the position in the group of every edge. The edges of
+	* a state have consecutive slots, starting at State::firstEdgeSlot.
+	*/
+	std::vector<std::pair<std::size_t,std::size_t>> EdgeSlots;
+
+	/**
+	* Adds the edges of a freshly initialized state to EdgeTable.
+	*/
+	void registerEdges(State& s)
+	{
+		s.setFirstEdgeSlot(EdgeSlots.size());
+
+		for(Edge* e : s.edges())
+		{
+			auto found = EdgeGroupOfType.find(e->Id);
+			if(found == EdgeGroupOfType.end())
+			{
+				found = EdgeGroupOfType.insert({e->Id,EdgeTable.size()}).first;
+				EdgeTable.push_back(EdgeGroup());
+				EdgeTable.back().Type = e->Id;
+			}
+
+			EdgeGroup& g = EdgeTable[found->second];
+
+			e->Group = found->second;
+			e->PositionInGroup = g.Edges.size();
+
+			g.Source.push_back(s.number());
+			g.Target.push_back(e->targetState.number());
+			g.Rate.push_back(e->transitionProbabilitie);
+			g.Edges.push_back(e);
+
+			EdgeSlots.push_back({e->Group,e->PositionInGroup});
+		}
+	}
+
+	/**
+	* Copies the rate of an edge that was updated with Edge::update to its
+	* group.
+	*/
+	void storeEdgeRate(Edge* e)
+	{
+		EdgeTable[e->Group].Rate[e->PositionInGroup] = e->transitionProbabilitie;
+	}
+
+	/**
+	* This method can be overwritten to calculate the rates of all edges of
+	* one type in a single call instead of one virtual Edge::update call per
+	* edge. The arrays of the group are contiguous, so the calculation can be
+	* vectorized. It is used by the methods that sweep over all states (ODE,
+	* masterEquation and logMoment) whenever a state of the group needs an
+	* actualisation. Note that it updates all edges of the group, also the
+	* ones of states where actualisationNeedet returned false.
+	*
+	* @param time The current time in the system.
+	* @param group The group whose Rate array should be filled.
+	* @return false if the group can not be updated in a batch. Edge::update
+	* is used for this group from then on. The default returns false.<br>
+	* It is always called by one thread at a time. The SectorSolver does not
+	* use it.
+	*/
+	virtual bool updateEdgeGroup(double time,EdgeGroup& group)
+	{
+		return false;
+	}
+
+	/**
+	* Runs the batched updates that were deferred by getProbabilities.
+	*/
+	void updatePendingEdgeGroups(double time)
+	{
+		for(EdgeGroup& g : EdgeTable)
+		{
+			if(!g.Pending)
+			{
+				continue;
+			}
+
+			g.Pending = false;
+
+			if(updateEdgeGroup(time,g))
+			{
+				//Only states whose rates really changed are marked, so the
+				//assembly of the masterequation keeps skipping the others.
+				for(std::size_t i = 0;i < g.Edges.size();i++)
+				{
+					if(g.Edges[i]->transitionProbabilitie != g.Rate[i])
+					{
+						g.Edges[i]->transitionProbabilitie = g.Rate[i];
+						allStates[g.Source[i]].markRatesChanged();
+					}
+				}
+			}
+			else
+			{
+				g.Batched = false;
+
+				for(Edge* e : g.PendingEdges)
+				{
+					e->update(time);
+					storeEdgeRate(e);
+					allStates[g.Source[e->PositionInGroup]].markRatesChanged();
+				}
+			}
+
+			g.PendingEdges.clear();
+		}
+	}
+
+	/**
+	* Brings the edges of all states up to date with the given time. Edges
+	* whose type supports it are updated in batches.
+	*/
+	void actualiseAllStates(double time)
+	{
+		for(State& s : allStates)
+		{
+			getProbabilities(time,s,true);
+		}
+
+		updatePendingEdgeGroups(time);
+	}
+
+	/**
+	* This Method returns the Transitions and Probabilities of the state s. It
+	* is used as a central internal hub for requests of the physical behaviour.
+	* It checks if the values stored should be actualized or not.
+	*
+	* @param deferBatched If this is true, edges whose group may be updated
+	* in a batch are not updated here. The caller has to call
+	* updatePendingEdgeGroups after it visited all states.
+	*/
+	std::vector<Edge*>& getProbabilities(double time,State& s,bool deferBatched = false)
+	{
+		if(!s.isInitialized())
+		{
+			createEdges(time,s);
+			registerEdges(s);
+		}
+		else
+		{
+			if(actualisationNeedet(time,s))
+			{
+				//Deferred edges mark their state in updatePendingEdgeGroups.
+				bool updated = false;
+
+				for(Edge* e: s.edges())
+				{
+					EdgeGroup& g = EdgeTable[e->Group];
+
+					if(deferBatched && g.Batched)
+					{
+						g.Pending = true;
+						g.PendingEdges.push_back(e);
+					}
+					else
+					{
+						e -> update(time);
+						storeEdgeRate(e);
+						updated = true;
+					}
+				}
+				s.setLastActualisation(time);
+
+				if(updated)
+				{
+					s.markRatesChanged();
+				}
+			}
+		}
+
+		return s.edges();
+	}
+	
+	std::string PathToSave;
+	
+	/**
+	* The name of the system and the filename for the data generated by the
+	* system.
+	*/
+	std::string SystemDesignator;
+
+	/**
+	* The Energy Niveaus that make up this system. The order the niveaus are
+	* listed in this vector make up the order that is relevant for the notation
+	* of states.
+	*/
+	std::vector<Niveau> Niveaus;
+	
+	public:
+
+	QuantumSystem(
+		std::vector<Niveau> niveaus,
+		double initialTime,
+		std::string pPathToSave,
+		std::string pSystemDesignator = ""
+	):
+		allStates(niveaus.size(),initialTime),
+		Niveaus(niveaus),
+		PathToSave(pPathToSave),
+		SystemDesignator(pSystemDesignator)
+	{}
+	
+	virtual ~QuantumSystem()
+	{
+		if(StreamFile.is_open())
+		{
+			StreamFile.close();
+			std::remove(streamPath().c_str());
+		}
+	}
+
+	/**
+	* Restricts the system to the states that can be reached from the states
+	* that are occupied in the initial occupation. They are created with a
+	* breadth first search on the first access of the masterequation or of
+	* logMoment. All other states are never created and have the occupation
+	* 0 forever, so unreachable states need no edges and no entries in the
+	* masterequation. The table of states only holds the created states, but
+	* the occupation vectors of the solvers still hold one value per state,
+	* so their memory still grows with 2^N.
+	*
+	* @param initialOccupation The occupation the solver starts with. It must
+	* have one entry per state.
+	*/
+	void useReachableStatesOnly(const std::vector<double>& initialOccupation)
+	{
+		for(std::size_t n = 0;n < initialOccupation.size();n++)
+		{
+			if(initialOccupation[n] != 0)
+			{
+				ReachableStatesSeeds.push_back(n);
+			}
+		}
+	}
+
+	/**
+	* This method provides external access on the transitions and their
+	* probabilities for a single state. Especially it is used by methods that
+	* work on the Graph it self like the MonteCarloWanderer Method. 
+	*
+	* @param originStateNum The identification-number of the state in question.
+	* @param time The time that corresponds to the transition values in
+	* question.
+	* @return a std::vector of std::pair<int,double>, where each pair represents
+	* a transition. The integer number is the end-state of the transition. The
+	* double is the probability that the transition occurs.
+	*/
+	std::vector<std::pair<int,double>> possibleTransitions(int originStateNum,double time)
+	{
+		//This works because by construction the number of the state is its
+		//index in the vecor
+		State& s = allStates[originStateNum];
+
+		getProbabilities(time,s);
+
+		std::vector<Edge*>& edges = s.edges();
+
+		std::vector<std::pair<int,double>> toReturn;
+
+		for(Edge* e : edges)
+		{
+			toReturn.push_back(std::make_pair(e->targetState.number(),e->transitionProbabilitie));
+		}
+
+		return toReturn;
+	}
+	
+	protected:
+	
+	/**
+	* The Matrix that is the main part of the systems masterequation. It is
+	* stored sparse, since there is only one entry per edge.
+	*/	
+	SparseMasterEquation W;
+	
+	/**
+	* Buffer for the transitions of one column during the assembly of W.
+	*/
+	std::vector<std::pair<arma::uword,double>> ColumnBuffer;
+
+	/**
+	* The matrix free representation of the masterequation. It is used instead
+	* of W if MatrixFree is true.
+	*/
+	HypercubeMasterEquation Hypercube;
+
+	/**
+	* If this is true ODE uses the matrix free kernel Hypercube instead of the
+	* matrix W.
+	*/
+	bool MatrixFree = false;
+
+	/**
+	* The states whose edges changed since the last assembly of W.
+	*/
+	std::vector<State*> ChangedStates;
+
+	/**
+	* Is increased whenever the values of W change. See
+	* masterEquationVersion.
+	*/
+	std::size_t MasterEquationVersion = 0;
+
+	/**
+	* Writes the transitions of the state s to ColumnBuffer. They are read
+	* from the arrays of EdgeTable, not from the edge objects.
+	*/
+	void fillColumnBuffer(State& s)
+	{
+		ColumnBuffer.clear();
+
+		std::size_t first = s.firstEdgeSlot();
+		std::size_t end = first + s.edges().size();
+
+		for(std::size_t k = first;k < end;k++)
+		{
+			const EdgeGroup& g = EdgeTable[EdgeSlots[k].first];
+			std::size_t i = EdgeSlots[k].second;
+
+			ColumnBuffer.push_back({(arma::uword)g.Target[i],g.Rate[i]});
+		}
+	}
+
+	/**
+	* Brings the entries of W up to date with the edges at the given time.
+	* Only the columns of states whose edges changed are rewritten. If no
+	* state changed, W is left untouched. W is only built from scratch on the
+	* first call or if a state got a transition to a new target state.
+	*/
+	void assembleMasterEquation(double time)
+	{
+		createReachableStates(time);
+
+		//In the matrix free mode the change markers belong to Hypercube.
+		bool rebuild = W.dimension() != allStates.size() || MatrixFree;
+
+		ChangedStates.clear();
+
+		actualiseAllStates(time);
+
+		for(State& s : allStates)
+		{
+			if(s.ratesChanged())
+			{
+				ChangedStates.push_back(&s);
+			}
+		}
+
+		if(!rebuild)
+		{
+			for(State* s : ChangedStates)
+			{
+				fillColumnBuffer(*s);
+
+				if(!W.updateColumn(s->number(),ColumnBuffer))
+				{
+					rebuild = true;
+					break;
+				}
+			}
+		}
+
+		if(rebuild)
+		{
+			W.reset(allStates.size());
+
+			for(State& s : allStates)
+			{
+				fillColumnBuffer(s);
+				W.appendColumn(s.number(),ColumnBuffer);
+			}
+		}
+
+		if(rebuild || !ChangedStates.empty())
+		{
+			MasterEquationVersion++;
+		}
+
+		if(!MatrixFree)
+		{
+			for(State* s : ChangedStates)
+			{
+				s->clearRatesChanged();
+			}
+		}
+	}
+
+	/**
+	* HypercubeSlots[k] is the position in Hypercube of the rate of the edge
+	* in EdgeSlots[k]. It is looked up when the edge is first written to
+	* Hypercube.
+	*/
+	std::vector<HypercubeMasterEquation::Slot> HypercubeSlots;
+
+	/**
+	* Brings the rates in Hypercube up to date with the edges at the given
+	* time. Only the rates of states whose edges changed are rewritten. The
+	* rates are read from the arrays of EdgeTable.
+	*/
+	void assembleHypercube(double time)
+	{
+		createReachableStates(time);
+
+		if(Hypercube.dimension() != allStates.size())
+		{
+			Hypercube.reset(allStates.size());
+			HypercubeSlots.clear();
+		}
+
+		actualiseAllStates(time);
+
+		//The positions of new edges are looked up once.
+		for(std::size_t k = HypercubeSlots.size();k < EdgeSlots.size();k++)
 		{
-			for(Edge* e : newEdges)
+			const EdgeGroup& g = EdgeTable[EdgeSlots[k].first];
+			std::size_t i = EdgeSlots[k].second;
+
+			HypercubeSlots.push_back(Hypercube.slot(g.Source[i]^g.Target[i],g.Source[i]));
+		}
+
+		for(State& s : allStates)
+		{
+			if(!s.ratesChanged())
 			{
-				Edges.push_back(e);
+				continue;
 			}
 
-			LastActualisation = time;
-			IsInitialized=true;
+			std::size_t first = s.firstEdgeSlot();
+			std::size_t end = first + s.edges().size();
+
+			//Edges with the same target are summed up. Edges of a state to
+			//itself have no slot and are skipped by Hypercube.
+			for(std::size_t k = first;k < end;k++)
+			{
+				Hypercube.setRate(HypercubeSlots[k],0);
+			}
+			for(std::size_t k = first;k < end;k++)
+			{
+				Hypercube.addRate(HypercubeSlots[k],EdgeTable[EdgeSlots[k].first].Rate[EdgeSlots[k].second]);
+			}
+
+			s.clearRatesChanged();
 		}
-		
-		/**
-		* Returns the time value where the last actualisation of the
-		* edge-transition values for the edges that point away from this point
-		* occured.
-		*/
-		double lastActualisation()
+	}
+
+	/**
+	* The times where the systemstate was saved. The index in this vector is
+	* the number of the keyframe.
+	*/
+	std::vector<double> SaveTimes;
+
+	/**
+	* The number of keyframes the solver announced with reserveKeyframes.
+	*/
+	std::size_t ExpectedKeyframes = 0;
+
+	/**
+	* The number of keyframes that are collected in memory before they are
+	* appended to the stream file. 0 means that the keyframes are not
+	* streamed but stored in the histories of the states and edges.
+	*/
+	std::size_t StreamChunkKeyframes = 0;
+
+	/**
+	* The number of values per keyframe in the stream file. There is one
+	* column per state and per edge, in the order they are written to the
+	* graphml file: every state followed by its edges.
+	*/
+	std::size_t StreamColumns = 0;
+
+	std::ofstream StreamFile;
+
+	/**
+	* The keyframes that were not yet appended to StreamFile.
+	*/
+	std::vector<double> StreamBuffer;
+
+	/**
+	* The file the keyframes are streamed to while the system is solved. It
+	* lies next to the graphml file and is deleted with the system.
+	*/
+	std::string streamPath()
+	{
+		return PathToSave + ".keyframes";
+	}
+
+	void flushStream()
+	{
+		if(!StreamBuffer.empty())
 		{
-			return LastActualisation;
+			StreamFile.write(reinterpret_cast<const char*>(StreamBuffer.data()),StreamBuffer.size()*sizeof(double));
+			StreamBuffer.clear();
 		}
-		
-		/**
-		* Returns the edges that point away from this node.
-		*/
-		std::vector<Edge*>& edges()
+
+		StreamFile.flush();
+
+		if(!StreamFile)
 		{
-			return Edges;
+			throw std::runtime_error("Could not write the keyframes to " + streamPath());
 		}
-		
-		/**
-		* Is used by the quantumsystem to automatically log the time by which
-		* the state was actualized.
-		*/
-		void setLastActualisation(double time)
+	}
+
+	/**
+	* The part of logMoment that appends a keyframe to the stream file. The
+	* columns are fixed by the first keyframe. All states and edges exist by
+	* then, because logMoment visits every state.
+	*/
+	void streamMoment(const std::vector<double>& occupation)
+	{
+		if(!StreamFile.is_open())
 		{
-			LastActualisation = time;
+			StreamColumns = 0;
+			for(State& s : allStates)
+			{
+				StreamColumns += 1 + s.edges().size();
+			}
+
+			StreamFile.open(streamPath(),std::ios::binary | std::ios::trunc);
+			if(!StreamFile)
+			{
+				throw std::runtime_error("Could not open " + streamPath());
+			}
+
+			StreamBuffer.reserve(StreamChunkKeyframes*StreamColumns);
 		}
 
-		/**
-		* returns the statenumber, i.e. the identifier of this state.
-		*/
-		int number()
+		std::size_t before = StreamBuffer.size();
+
+		for(State& s : allStates)
 		{
-			return StateNumber;
+			StreamBuffer.push_back(occupation[s.number()]);
+			for(Edge* e : s.edges())
+			{
+				StreamBuffer.push_back(e->transitionProbabilitie);
+			}
 		}
-		
-		/**
-		* Returns the occupied levels variable. With this it should be easier to
-		* create the edges.
-		*/
-		BinaryNumber occupiedLevels()
+
+		if(StreamBuffer.size() - before != StreamColumns)
 		{
-			return OccupiedLevels;
+			throw std::runtime_error("The graph of " + SystemDesignator + " changed while its keyframes were streamed.");
 		}
 
-		/**
-		* Saves the given occupation value to the Occupation map. This Method is
-		* used by the solver to save the state of the system for a given
-		* keyframe.
-		*/
-		void logOccupation(std::string timeKey,double occ)
+		if(StreamBuffer.size() >= StreamChunkKeyframes*StreamColumns)
 		{
-			Occupation.insert({timeKey,occ});
+			flushStream();
 		}
-		
-		/**
-		* Outputs the Occupation and other parameters that make up this node as
-		* graphml snippet.
-		*/
-		void writeToFile(std::ofstream& file,int indentTabs)
+	}
+
+	/**
+	* Writes the states and edges with the keyframes from the stream file.
+	* The file holds one keyframe after the other, but the graphml file needs
+	* all keyframes of one state or edge after each other. The columns are
+	* therefore read in blocks that are not larger than one chunk, so the
+	* memory needed does not grow with the number of keyframes as long as
+	* there are less keyframes than values in a chunk.
+	*/
+	void writeStreamedGraph(std::ofstream& file,const std::vector<std::string>& nodeDataKeys,const std::vector<std::string>& edgeDataKeys)
+	{
+		flushStream();
+
+		std::size_t keyframes = SaveTimes.size();
+		std::size_t blockColumns = std::max<std::size_t>(1,StreamChunkKeyframes*StreamColumns/std::max<std::size_t>(1,keyframes));
+
+		std::ifstream stream(streamPath(),std::ios::binary);
+		std::vector<KeyframeHistory> block(std::min(blockColumns,StreamColumns));
+		std::vector<double> row(block.size());
+		std::size_t blockBegin = 0;
+		std::size_t blockEnd = 0;
+
+		auto column = [&](std::size_t c) -> const KeyframeHistory&
 		{
-			std::string indent = "";
-			for(int i = 0;i<indentTabs;i++)
+			if(c >= blockEnd)
 			{
-				indent += '\t';
+				blockBegin = c;
+				blockEnd = std::min(c + blockColumns,StreamColumns);
+				std::size_t width = blockEnd - blockBegin;
+
+				for(std::size_t j = 0;j < width;j++)
+				{
+					block[j].Values.resize(keyframes);
+				}
+
+				for(std::size_t k = 0;k < keyframes;k++)
+				{
+					stream.seekg((k*StreamColumns + blockBegin)*sizeof(double));
+					stream.read(reinterpret_cast<char*>(row.data()),width*sizeof(double));
+
+					for(std::size_t j = 0;j < width;j++)
+					{
+						block[j].Values[k] = row[j];
+					}
+				}
+
+				if(!stream)
+				{
+					throw std::runtime_error("Could not read the keyframes from " + streamPath());
+				}
 			}
-			file << indent <<	"<node id=\"" << StateNumber << "\">" << "\n";
-			
-			for(auto pair : Occupation)
+
+			return block[c - blockBegin];
+		};
+
+		std::size_t c = 0;
+		for(State& s : allStates)
+		{
+			s.writeToFile(file,1,nodeDataKeys,column(c++));
+			for(Edge* e: s.edges())
 			{
-				file << indent << '\t' << "<data key=\"" << pair.first << "\">";
-				file << pair.second;
-				file << "</data>" << '\n';
+				e->writeToFile(file,2,s.number(),edgeDataKeys,column(c++));
 			}
-			file << indent <<	"</node>" << "\n";
-
 		}
+	}
 
-		/**
-		* Returns the initialisation status of the node. Initialized means that
-		* all the edges are generated and their transition probabilities are
-		* calculated. The method is used by the Quantumsystem to keep track of
-		* the calculated values.
-		*/
-		bool isInitialized()
+	/**
+	* Returns the timestamps of the keyframes as they are used in the keys of
+	* the graphml file. If two keyframes are too close to be told apart by the
+	* default format, more digits are used and the number of the keyframe is
+	* appended if that is not enough either.
+	*/
+	std::vector<std::string> timeKeys()
+	{
+		std::vector<std::string> toReturn;
+		std::set<std::string> used;
+
+		for(std::size_t k = 0;k < SaveTimes.size();k++)
 		{
-			return IsInitialized;
+			std::string key = std::to_string(SaveTimes[k]);
+
+			if(used.count(key))
+			{
+				std::ostringstream precise;
+				precise << std::setprecision(17) << SaveTimes[k];
+				key = precise.str();
+			}
+			if(used.count(key))
+			{
+				key += "_" + std::to_string(k);
+			}
+
+			used.insert(key);
+			toReturn.push_back(key);
 		}
 
-	};
+		return toReturn;
+	}
 	
 	/**
-	* This vector holds all States the system can be found in. It is used as a
-	* lookup-table.
+	* The specifier for the keys of the edgevalues in the Graphml file
 	*/
-	std::vector<State> allStates;
+	std::string edgeKeySpecifier = SystemDesignator+"Wheights_At_t=";
 	
 	/**
-	* This method should return true if the probabilities of a state should be
-	* actualized at a given time. Therefore it can compare the last
-	* actualisation time of the state, which corresponds to the states values
-	* with the time given. 
-	* Note that is must not check if the state is initilised or not since this
-	* check is already been done at the point this method is called.
-	* Also see getProbabilities.
+	* The specifier for the keys of the node occupation values in the Graphml file
 	*/
-	virtual bool actualisationNeedet(double time,State& s)=0;
+	std::string nodeKeySpecifier = SystemDesignator+"Occupation_At_t=";
 	
 	/**
-	* This method creates all edges and initializes their transition values. It
-	* is used to initialize a state.
-	*/	
-	virtual void createEdges(double time,State& s)=0;
+	* The specifier for the keys of the edgevalues in the edges in the graphml
+	* file.
+	*/
+	std::string edgeDataSpecifier = SystemDesignator+"Wheights_@_";
+	
+	/**
+	* The specifiers for the Node-Occupation values saved in the node snippets
+	* in the graphml file.
+	*/
+	std::string nodeDataSpecifier = SystemDesignator+"Occupation_@_";
+	
+	/**
+	* The format writeToFile uses.
+	*/
+	OutputFormat Format = OutputFormat::GraphML;
 
 	/**
-	* This Method returns the Transitions and Probabilities of the state s. It
-	* is used as a central internal hub for requests of the physical behaviour.
-	* It checks if the values stored should be actualized or not.
+	* Writes the system-saves in the binary output format. The file consists
+	* of a header, the keyframe times and two matrices. All numbers are little
+	* endian, integers are uint64, floats are float64 and strings are stored
+	* as uint64 length followed by the characters:
+	*
+	*	char[8]   "FSRESULT"
+	*	uint64    version (1)
+	*	uint64    byte offset of the keyframe times (a multiple of 8)
+	*	uint64    number of niveaus N, states S, edges E and keyframes K
+	*	string    SystemDesignator
+	*	N times   name, energy, spin, charge of the niveau
+	*	S times   number of the state, first keyframe logged for the state
+	*	E times   source, target, first keyframe logged for the edge, Id
+	*	padding   zeros up to the offset of the keyframe times
+	*	float64   times[K]
+	*	float64   occupation[K][S]
+	*	float64   rates[K][E]
+	*
+	* The states and edges are in the order they have in the graphml file.
+	* Values of keyframes before the first keyframe of a state or edge are
+	* NaN. tools/binaryResults.py reads these files with numpy.memmap and
+	* converts them to the graphml file writeToFile would have written.
 	*/
-	std::vector<Edge*> getProbabilities(double time,State& s)
+	void writeToBinaryFile(std::ostream& file)
 	{
-		if(!s.isInitialized())
+		std::vector<State*> states;
+		std::vector<Edge*> edges;
+		collectGraph(states,edges);
+
+		std::ostringstream header(std::ios::binary);
+		writeLittleEndian(header,SystemDesignator);
+		for(Niveau& n : Niveaus)
 		{
-			createEdges(time,s);
+			n.writeToBinaryFile(header);
 		}
-		else
+		for(State* s : states)
 		{
-			if(actualisationNeedet(time,s))
+			writeLittleEndian(header,(std::uint64_t)s->number());
+			writeLittleEndian(header,(std::uint64_t)firstKeyframe(s->occupation()));
+		}
+		for(State* s : states)
+		{
+			for(Edge* e: s->edges())
 			{
-				for(Edge* e: s.edges())
-					e -> update(time);
-				s.setLastActualisation(time);
+				writeLittleEndian(header,(std::uint64_t)s->number());
+				writeLittleEndian(header,(std::uint64_t)e->targetState.number());
+				writeLittleEndian(header,(std::uint64_t)firstKeyframe(e->rate));
+				writeLittleEndian(header,e->Id);
 			}
 		}
 
-		return s.edges();
+		file.write("FSRESULT",8);
+		writeLittleEndian(file,(std::uint64_t)1);
+		std::uint64_t counts[] = {Niveaus.size(),states.size(),edges.size(),SaveTimes.size()};
+		writeKeyframes(file,header.str(),counts,4,states,edges);
 	}
-	
-	std::string PathToSave;
-	
+
 	/**
-	* The name of the system and the filename for the data generated by the
-	* system.
+	* Collects the states and edges in the order they have in the output
+	* files.
 	*/
-	std::string SystemDesignator;
+	void collectGraph(std::vector<State*>& states,std::vector<Edge*>& edges)
+	{
+		for(State& s : allStates)
+		{
+			states.push_back(&s);
+			for(Edge* e: s.edges())
+			{
+				edges.push_back(e);
+			}
+		}
+	}
 
 	/**
-	* The Energy Niveaus that make up this system. The order the niveaus are
-	* listed in this vector make up the order that is relevant for the notation
-	* of states.
+	* Returns the first keyframe of a history in the output files. Streamed
+	* keyframes always start with the first keyframe.
 	*/
-	std::vector<Niveau> Niveaus;
-	
-	public:
+	std::size_t firstKeyframe(const KeyframeHistory& history)
+	{
+		return StreamFile.is_open() ? 0 : history.FirstKeyframe;
+	}
 
-	QuantumSystem(
-		std::vector<Niveau> niveaus,
-		double initialTime,
-		std::string pPathToSave,
-		std::string pSystemDesignator = ""
-	):
-		Niveaus(niveaus),
-		PathToSave(pPathToSave),
-		SystemDesignator(pSystemDesignator)
+	/**
+	* Writes the rest of a binary output file after the magic number and the
+	* version: the offset of the keyframe times, the counts, the rest of the
+	* header, padding up to the offset, the times and the occupation and rate
+	* matrices.
+	*/
+	void writeKeyframes(std::ostream& file,const std::string& header,const std::uint64_t* counts,std::size_t numberOfCounts,const std::vector<State*>& states,const std::vector<Edge*>& edges)
 	{
-		
-		int numberOfStates = pow(2,niveaus.size());
+		if(StreamFile.is_open())
+		{
+			flushStream();
+		}
 
-		for(int stateNum =0; stateNum< numberOfStates;stateNum++)
+		std::size_t keyframes = SaveTimes.size();
+		const std::size_t fixedHeaderBytes = 8 + 8 + 8 + numberOfCounts*8;
+		std::size_t dataOffset = (fixedHeaderBytes + header.size() + 7)/8*8;
+
+		writeLittleEndian(file,(std::uint64_t)dataOffset);
+		writeLittleEndian(file,counts,numberOfCounts);
+		file << header;
+		file << std::string(dataOffset - fixedHeaderBytes - header.size(),'\0');
+
+		writeLittleEndian(file,SaveTimes.data(),keyframes);
+
+		//The matrices are written row by row, one keyframe at a time: first
+		//all rows of the occupation, then all rows of the rates. The
+		//histories are read column wise, the stream file row wise.
+		std::vector<double> row;
+		std::vector<double> streamRow(StreamColumns);
+		std::ifstream stream;
+
+		if(StreamFile.is_open())
 		{
-			allStates.push_back(State(stateNum,initialTime,niveaus.size()));
+			stream.open(streamPath(),std::ios::binary);
+		}
+
+		for(bool rates : {false,true})
+		{
+			row.resize(rates ? edges.size() : states.size());
+
+			for(std::size_t k = 0;k < keyframes;k++)
+			{
+				if(StreamFile.is_open())
+				{
+					stream.seekg(k*StreamColumns*sizeof(double));
+					stream.read(reinterpret_cast<char*>(streamRow.data()),StreamColumns*sizeof(double));
+
+					if(!stream)
+					{
+						throw std::runtime_error("Could not read the keyframes from " + streamPath());
+					}
+
+					std::size_t c = 0;
+					std::size_t i = 0;
+					for(State* s : states)
+					{
+						if(!rates)
+						{
+							row[i++] = streamRow[c];
+						}
+						c++;
+
+						for(std::size_t j = 0;j < s->edges().size();j++)
+						{
+							if(rates)
+							{
+								row[i++] = streamRow[c];
+							}
+							c++;
+						}
+					}
+				}
+				else if(rates)
+				{
+					for(std::size_t i = 0;i < edges.size();i++)
+					{
+						row[i] = edges[i]->rate.at(k);
+					}
+				}
+				else
+				{
+					for(std::size_t n = 0;n < states.size();n++)
+					{
+						row[n] = states[n]->occupation().at(k);
+					}
+				}
+
+				writeLittleEndian(file,row.data(),row.size());
+			}
 		}
 	}
-	
-	virtual ~QuantumSystem()
+
+	/**
+	* Writes the parts of the system that are the same for all measurements
+	* of a sweep: the niveaus, the states and the edges. The layout follows
+	* the binary output format:
+	*
+	*	char[8]   "FSTOPOLO"
+	*	uint64    version (1)
+	*	uint64    number of niveaus N, states S and edges E
+	*	N times   name, energy, spin, charge of the niveau
+	*	S times   number of the state
+	*	E times   source, target, Id
+	*/
+	void writeTopology(std::ostream& file)
+	{
+		std::vector<State*> states;
+		std::vector<Edge*> edges;
+		collectGraph(states,edges);
+
+		file.write("FSTOPOLO",8);
+		writeLittleEndian(file,(std::uint64_t)1);
+		writeLittleEndian(file,(std::uint64_t)Niveaus.size());
+		writeLittleEndian(file,(std::uint64_t)states.size());
+		writeLittleEndian(file,(std::uint64_t)edges.size());
+
+		for(Niveau& n : Niveaus)
+		{
+			n.writeToBinaryFile(file);
+		}
+		for(State* s : states)
+		{
+			writeLittleEndian(file,(std::uint64_t)s->number());
+		}
+		for(State* s : states)
+		{
+			for(Edge* e: s->edges())
+			{
+				writeLittleEndian(file,(std::uint64_t)s->number());
+				writeLittleEndian(file,(std::uint64_t)e->targetState.number());
+				writeLittleEndian(file,e->Id);
+			}
+		}
+	}
+
+	/**
+	* Returns the hash of the output of writeTopology. Systems with the same
+	* hash share their topology.
+	*/
+	std::string topologyHash()
 	{
-		
+		std::ostringstream topology(std::ios::binary);
+		writeTopology(topology);
+
+		return contentHash(topology.str());
 	}
 
 	/**
-	* This method provides external access on the transitions and their
-	* probabilities for a single state. Especially it is used by methods that
-	* work on the Graph it self like the MonteCarloWanderer Method. 
+	* Writes only the values of the keyframes and a reference to the
+	* topology. The layout is the one of writeToBinaryFile without the
+	* niveaus, the states and the edges:
 	*
-	* @param originStateNum The identification-number of the state in question.
-	* @param time The time that corresponds to the transition values in
-	* question.
-	* @return a std::vector of std::pair<int,double>, where each pair represents
-	* a transition. The integer number is the end-state of the transition. The
-	* double is the probability that the transition occurs.
+	*	char[8]   "FSSERIES"
+	*	uint64    version (1)
+	*	uint64    byte offset of the keyframe times (a multiple of 8)
+	*	uint64    number of states S, edges E and keyframes K
+	*	string    hash of the topology
+	*	string    SystemDesignator
+	*	S times   first keyframe logged for the state
+	*	E times   first keyframe logged for the edge
+	*	padding   zeros up to the offset of the keyframe times
+	*	float64   times[K]
+	*	float64   occupation[K][S]
+	*	float64   rates[K][E]
 	*/
-	std::vector<std::pair<int,double>> possibleTransitions(int originStateNum,double time)
+	void writeSeries(std::ostream& file,const std::string& hash)
 	{
-		//This works because by construction the number of the state is its
-		//index in the vecor
-		State& s = allStates[originStateNum];
+		std::vector<State*> states;
+		std::vector<Edge*> edges;
+		collectGraph(states,edges);
 
-		getProbabilities(time,s);
+		std::ostringstream header(std::ios::binary);
+		writeLittleEndian(header,hash);
+		writeLittleEndian(header,SystemDesignator);
+		for(State* s : states)
+		{
+			writeLittleEndian(header,(std::uint64_t)firstKeyframe(s->occupation()));
+		}
+		for(Edge* e : edges)
+		{
+			writeLittleEndian(header,(std::uint64_t)firstKeyframe(e->rate));
+		}
 
-		std::vector<Edge*>& edges = s.edges();
+		file.write("FSSERIES",8);
+		writeLittleEndian(file,(std::uint64_t)1);
+		std::uint64_t counts[] = {states.size(),edges.size(),SaveTimes.size()};
+		writeKeyframes(file,header.str(),counts,3,states,edges);
+	}
 
-		std::vector<std::pair<int,double>> toReturn;
+	/**
+	* Writes the system-saves in the binary output format to PathToSave.
+	*/
+	void writeToBinaryFile()
+	{
+		std::ofstream file(PathToSave,std::ios::binary | std::ios::trunc);
 
-		for(Edge* e : edges)
+		writeToBinaryFile(file);
+
+		if(!file)
 		{
-			toReturn.push_back(std::make_pair(e->targetState.number(),e->transitionProbabilitie));
+			throw std::runtime_error("Could not write " + PathToSave);
 		}
 
-		return toReturn;
+		file.close();
 	}
-	
-	protected:
-	
+
 	/**
-	* The Matrix that is the main part of the systems masterequation.
-	*/	
-	arma::Mat<double> W;
-	
+	* If this is set, writeToFile appends the result to this archive instead
+	* of writing a file of its own (see saveToArchive).
+	*/
+	ResultArchive* Archive = nullptr;
+
 	/**
-	* Is true if the Matrix W has been initialized
+	* The number of the measurement in Archive.
 	*/
-	bool WInitialized=false;
+	std::size_t ArchiveRecord = 0;
 
 	/**
-	* The Timekeys that encode the time where the systemstate was saved.
+	* If this is set, writeToFile saves the topology of the system in this
+	* store and writes only the values of the keyframes (see shareTopology).
 	*/
-	std::vector<std::string> saveTimeKeys;
-	
+	TopologyStore* Topologies = nullptr;
+
+	public:
+
 	/**
-	* The specifier for the keys of the edgevalues in the Graphml file
+	* Selects the format writeToFile uses. The binary format is smaller,
+	* faster to write and read and stores the values without rounding.
 	*/
-	std::string edgeKeySpecifier = SystemDesignator+"Wheights_At_t=";
-	
+	void setOutputFormat(OutputFormat format)
+	{
+		Format = format;
+	}
+
 	/**
-	* The specifier for the keys of the node occupation values in the Graphml file
+	* Makes writeToFile append the result to an archive that holds all
+	* measurements of an experiment instead of writing a file of its own. The
+	* result is always stored in the binary output format. It is used by
+	* Experiment in the archive mode.
+	*
+	* @param record The number ResultArchive::addRecord returned for this
+	* measurement.
 	*/
-	std::string nodeKeySpecifier = SystemDesignator+"Occupation_At_t=";
-	
+	void saveToArchive(ResultArchive* archive,std::size_t record)
+	{
+		Archive = archive;
+		ArchiveRecord = record;
+	}
+
 	/**
-	* The specifier for the keys of the edgevalues in the edges in the graphml
-	* file.
+	* Makes writeToFile save the niveaus, states and edges in the given
+	* store, where they are kept only once for all systems with the same
+	* topology. The result file (or the archive entry) then only holds the
+	* values of the keyframes and the hash of the topology (see writeSeries).
+	* Like the binary output format, this mode is meant for large sweeps.
 	*/
-	std::string edgeDataSpecifier = SystemDesignator+"Wheights_@_";
+	void shareTopology(TopologyStore* topologies)
+	{
+		Topologies = topologies;
+	}
 	
 	/**
-	* The specifiers for the Node-Occupation values saved in the node snippets
-	* in the graphml file.
+	* Announces the number of keyframes the solver will log. The histories of
+	* the nodes and edges are then allocated once at the first keyframe.
 	*/
-	std::string nodeDataSpecifier = SystemDesignator+"Occupation_@_";
-	
-	public:
-	
+	void reserveKeyframes(std::size_t keyframes)
+	{
+		ExpectedKeyframes = keyframes;
+		SaveTimes.reserve(keyframes);
+	}
+
+	/**
+	* Streams the keyframes to a file next to the graphml file while the
+	* system is solved instead of keeping them in memory. Only chunkKeyframes
+	* keyframes are held in memory at once. writeToFile turns the stream into
+	* the usual graphml file. Use this for long runs with many keyframes. It
+	* has to be called before the first logMoment.
+	*
+	* @param chunkKeyframes The number of keyframes that are collected before
+	* they are written to the file. 0 switches streaming off.
+	*/
+	void streamKeyframes(std::size_t chunkKeyframes = 64)
+	{
+		if(!SaveTimes.empty())
+		{
+			throw std::runtime_error("Keyframes of " + SystemDesignator + " were logged before streaming was switched on.");
+		}
+
+		StreamChunkKeyframes = chunkKeyframes;
+	}
+
 	/**
 	* Makes a snapshot of the system at a given time.
 	*/
-	void logMoment(double time,std::vector<double> occupation)
+	void logMoment(double time,const std::vector<double>& occupation)
 	{	
-		std::string timeKey = std::to_string(time);
-		
-		saveTimeKeys.push_back(timeKey);
+		createReachableStates(time);
+
+		std::size_t keyframe = SaveTimes.size();
+		SaveTimes.push_back(time);
 		
-		for(State& s : allStates)
+		actualiseAllStates(time);
+
+		if(StreamChunkKeyframes > 0)
 		{
-			getProbabilities(time,s);
+			streamMoment(occupation);
+			return;
+		}
 
+		for(State& s : allStates)
+		{
 			std::vector<Edge*>& edges = s.edges();
 			for(Edge* e : edges)
 			{
-				e->rate.insert({edgeDataSpecifier+timeKey,e->transitionProbabilitie});
+				e->rate.log(keyframe,e->transitionProbabilitie,ExpectedKeyframes);
 			}
 
-			s.logOccupation(nodeDataSpecifier+timeKey,occupation[s.number()]);
+			s.logOccupation(keyframe,occupation[s.number()],ExpectedKeyframes);
 		}
 	}
 
@@ -729,45 +3054,113 @@ class QuantumSystem
 	/**
 	* This Method is used to access the Masterequation of this quantumsystem. It
 	* is mainly used by odesolvers or analytical solutions of the system if they
-	* exist.
+	* exist. If the rates did not change since the last call, it allocates no
+	* memory.
 	*/
-	arma::Col<double> ODE(double time,arma::Col<double> probabilities)
+	void ODE(double time,const arma::Col<double>& probabilities,arma::Col<double>& derivative) override
 	{
-		if(!WInitialized)
+		if(MatrixFree)
 		{
-			W=arma::mat(allStates.size(),allStates.size(),arma::fill::zeros);
-			WInitialized=true;
+			assembleHypercube(time);
+			Hypercube.multiply(probabilities,derivative);
+			return;
 		}
 
-		for(State& s : allStates)
-		{
-			getProbabilities(time,s);
+		assembleMasterEquation(time);
+		W.multiply(probabilities,derivative);
+	}
 
-			double pGo = 0;
+	using DifferentialEquation::ODE;
 
-			std::vector<Edge*>& edges = s.edges();
-			
-			for(Edge* e : edges)
+	/**
+	* Switches ODE between the sparse matrix W and the matrix free kernel
+	* Hypercube. Both give the same result. The matrix free kernel stores the
+	* rates per mask instead of per column and never stores the diagonal.
+	*/
+	void useMatrixFreeKernel(bool matrixFree)
+	{
+		//Only the states that exist are marked. Iterating over allStates
+		//would create all states before the reachable states are known.
+		if(matrixFree != MatrixFree)
+		{
+			for(State* s : allStates.createdStates())
 			{
-				W(e->targetState.number(),s.number()) = e->transitionProbabilitie;
-				pGo -= e->transitionProbabilitie;
-
+				s->markRatesChanged();
 			}
-
-			W(s.number(),s.number()) =pGo;
 		}
-		
-		arma::Col<double> to_return = W*probabilities;
 
-		return to_return;
+		MatrixFree = matrixFree;
+	}
+
+	/**
+	* Returns the matrix of the masterequation at the given time. It is meant
+	* for solvers that work on the matrix itself instead of only evaluating
+	* the ODE. In the matrix free mode the matrix is built from scratch on
+	* every call.
+	*/
+	const SparseMasterEquation& masterEquation(double time)
+	{
+		assembleMasterEquation(time);
+
+		return W;
+	}
+
+	/**
+	* Returns a number that changes whenever the matrix of the masterequation
+	* changes. Solvers that keep a factorisation of the matrix use it to find
+	* out whether the factorisation is still valid. In the matrix free mode it
+	* changes on every call of masterEquation.
+	*/
+	std::size_t masterEquationVersion()
+	{
+		return MasterEquationVersion;
 	}
 	
 	/**
 	* Writes the system-saves to a graphml file that contains the Systemgraph
 	* and the Values of the edges and nodeoccupation on the key-frame-times.
+	* If the binary output format is selected (see setOutputFormat), the file
+	* is written by writeToBinaryFile instead. If the system belongs to an
+	* archive (see saveToArchive), the result is appended to the archive. If
+	* the topology is shared (see shareTopology), only the values are written
+	* by writeSeries.
 	*/
 	void writeToFile()
 	{
+		if(Topologies != nullptr)
+		{
+			std::string hash = topologyHash();
+			Topologies->store(hash,[this](std::ostream& file){writeTopology(file);});
+
+			auto writeValues = [this,&hash](std::ostream& file){writeSeries(file,hash);};
+
+			if(Archive != nullptr)
+			{
+				Archive->append(ArchiveRecord,writeValues);
+				return;
+			}
+
+			std::ofstream file(PathToSave,std::ios::binary | std::ios::trunc);
+			writeValues(file);
+			if(!file)
+			{
+				throw std::runtime_error("Could not write " + PathToSave);
+			}
+			return;
+		}
+
+		if(Archive != nullptr)
+		{
+			Archive->append(ArchiveRecord,[this](std::ostream& file){writeToBinaryFile(file);});
+			return;
+		}
+
+		if(Format == OutputFormat::Binary)
+		{
+			writeToBinaryFile();
+			return;
+		}
+
 		std::ofstream file(PathToSave);
 		
 		file << "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n\n";
@@ -783,8 +3176,15 @@ class QuantumSystem
 
 		file << "<graphml xmlns=\"GraphInfo\">\n";
 		
-		for(std::string t : saveTimeKeys)
+		std::vector<std::string> keys = timeKeys();
+		std::vector<std::string> nodeDataKeys;
+		std::vector<std::string> edgeDataKeys;
+
+		for(std::string& t : keys)
 		{
+			nodeDataKeys.push_back(nodeDataSpecifier+t);
+			edgeDataKeys.push_back(edgeDataSpecifier+t);
+
 			//Node Keys
 			file << '\t' << "<key attr.name=\""<< nodeKeySpecifier << t;
 			file << "\" attr.type=\"float\" for=\"node\" id=\"";
@@ -796,12 +3196,19 @@ class QuantumSystem
 		}
 					
 		file << "<graph edgedefault=\"directed\">\n";
-		for(State& s : allStates)
+		if(StreamFile.is_open())
 		{
-			s.writeToFile(file,1);
-			for(Edge* e: s.edges())
+			writeStreamedGraph(file,nodeDataKeys,edgeDataKeys);
+		}
+		else
+		{
+			for(State& s : allStates)
 			{
-				e->writeToFile(file,2,s.number());
+				s.writeToFile(file,1,nodeDataKeys);
+				for(Edge* e: s.edges())
+				{
+					e->writeToFile(file,2,s.number(),edgeDataKeys);
+				}
 			}
 		}
 
@@ -819,5 +3226,264 @@ class QuantumSystem
 	int numberOfStates()
 	{
 		return allStates.size();
-	}	
+	}
+
+	/**
+	* Returns the number of bytes the system uses at the moment: the created
+	* states with their edges and histories, the masterequation and the
+	* keyframe times. Memory of subclasses and of the allocator is not
+	* counted, so it is a lower bound.
+	*/
+	std::size_t memoryFootprint()
+	{
+		return sizeof(*this) +
+			allStates.memoryFootprint() +
+			W.memoryFootprint() +
+			Hypercube.memoryFootprint() +
+			HypercubeSlots.capacity()*sizeof(HypercubeMasterEquation::Slot) +
+			(SaveTimes.capacity() + StreamBuffer.capacity())*sizeof(double);
+	}
+
+	/**
+	* Estimates the number of bytes the system will use once it is solved.
+	* Nothing has to be created for this, so it can be called right after
+	* the construction of the system and its solver. The estimate assumes
+	* that all states are created, that every state has one edge per niveau
+	* like in systems where single electrons tunnel, and that the histories
+	* hold all keyframes the solver announced (see reserveKeyframes). The
+	* solver is counted with a few vectors of one value per state.
+	*/
+	std::size_t estimatedMemoryFootprint()
+	{
+		std::size_t history = StreamChunkKeyframes > 0 ? 0 : ExpectedKeyframes*sizeof(double);
+		std::size_t matrixEntry = sizeof(arma::uword) + sizeof(double);
+
+		std::size_t edge = sizeof(Edge*) + sizeof(Edge) + history + matrixEntry;
+		std::size_t state = sizeof(std::unique_ptr<State>) + sizeof(State) + history + Niveaus.size()*edge + matrixEntry + 4*sizeof(double);
+
+		return sizeof(*this) +
+			allStates.size()*state +
+			ExpectedKeyframes*sizeof(double) +
+			StreamChunkKeyframes*(StreamColumns > 0 ? StreamColumns : allStates.size()*(Niveaus.size()+1))*sizeof(double);
+	}
+
+	/**
+	* A set of states that has no edges to states outside the set and no
+	* edges pointing into it from the outside. The masterequation of the
+	* states in a sector does not depend on the rest of the system, so every
+	* sector can be solved as a problem of its own. The vectors a sector works
+	* on hold one entry per state of the sector in the order of states().
+	* <br>
+	* Different sectors never share states. Their ODEs can therefore be
+	* evaluated in parallel, as long as the actualisationNeedet, createEdges
+	* and Edge::update implementations of the system only read shared data.
+	* For the same reason the rates of a sector are always updated edge by
+	* edge with Edge::update: a batched updateEdgeGroup call writes the edges
+	* of all sectors at once and would race with the other threads.
+	*/
+	class Sector : public DifferentialEquation
+	{
+		friend class QuantumSystem;
+
+		protected:
+
+		QuantumSystem* System;
+
+		/**
+		* The numbers of the states in this sector in ascending order.
+		*/
+		std::vector<std::size_t> States;
+
+		/**
+		* The block of the masterequation that belongs to this sector, in
+		* the local numbering of the states. It is kept up to date by
+		* QuantumSystem::sectorODE.
+		*/
+		SparseMasterEquation Block;
+
+		/**
+		* The State::ratesVersion of every state when its column of Block
+		* was written.
+		*/
+		std::vector<std::size_t> WrittenVersions;
+
+		std::vector<std::pair<arma::uword,double>> ColumnBuffer;
+
+		public:
+
+		Sector(QuantumSystem* system,std::vector<std::size_t> states):
+			System(system),
+			States(states)
+		{}
+
+		using DifferentialEquation::ODE;
+
+		void ODE(double time,const arma::Col<double>& probabilities,arma::Col<double>& derivative) override
+		{
+			System->sectorODE(time,probabilities,*this,derivative);
+		}
+
+		/**
+		* Returns the numbers of the states in this sector.
+		*/
+		const std::vector<std::size_t>& states() const
+		{
+			return States;
+		}
+	};
+
+	/**
+	* Splits the state graph into its connected components, i.e. into
+	* independent blocks of the masterequation. If the system conserves a
+	* quantity like the total charge or the total spin, every value of the
+	* quantity gets its own sector. All states that are part of the
+	* masterequation are initialized at the given time.
+	*
+	* @return The sectors, ordered by their lowest state number.
+	*/
+	std::vector<Sector> invariantSectors(double time)
+	{
+		createReachableStates(time);
+
+		//Union-find over the edges. Parent of a state that is not part of
+		//the masterequation stays at the state itself.
+		std::vector<std::size_t> parent(allStates.size());
+		for(std::size_t n = 0;n < parent.size();n++)
+		{
+			parent[n] = n;
+		}
+
+		auto root = [&parent](std::size_t n)
+		{
+			while(parent[n] != n)
+			{
+				parent[n] = parent[parent[n]];
+				n = parent[n];
+			}
+			return n;
+		};
+
+		std::vector<std::size_t> members;
+
+		for(State& s : allStates)
+		{
+			members.push_back(s.number());
+
+			for(Edge* e : getProbabilities(time,s))
+			{
+				std::size_t a = root(s.number());
+				std::size_t b = root(e->targetState.number());
+
+				if(a != b)
+				{
+					parent[std::max(a,b)] = std::min(a,b);
+				}
+			}
+		}
+
+		//The root of every set is its lowest state, so the sectors are
+		//created in the order of their lowest state.
+		std::vector<std::vector<std::size_t>> groups;
+		std::map<std::size_t,std::size_t> groupOfRoot;
+		SectorLocalIndex.assign(allStates.size(),0);
+
+		for(std::size_t n : members)
+		{
+			std::size_t r = root(n);
+
+			auto found = groupOfRoot.find(r);
+			if(found == groupOfRoot.end())
+			{
+				found = groupOfRoot.insert({r,groups.size()}).first;
+				groups.push_back({});
+			}
+
+			SectorLocalIndex[n] = groups[found->second].size();
+			groups[found->second].push_back(n);
+		}
+
+		std::vector<Sector> sectors;
+		for(auto& g : groups)
+		{
+			sectors.push_back(Sector(this,g));
+		}
+
+		return sectors;
+	}
+
+	protected:
+
+	/**
+	* SectorLocalIndex[n] is the position of the state n inside its sector.
+	* It is filled by invariantSectors.
+	*/
+	std::vector<std::size_t> SectorLocalIndex;
+
+	/**
+	* Writes the transitions of the state s to the column buffer of a sector,
+	* with the targets in the local numbering of the sector.
+	*/
+	void fillSectorColumn(Sector& sector,State& s)
+	{
+		sector.ColumnBuffer.clear();
+
+		for(Edge* e : s.edges())
+		{
+			sector.ColumnBuffer.push_back({(arma::uword)SectorLocalIndex[e->targetState.number()],e->transitionProbabilitie});
+		}
+	}
+
+	/**
+	* Evaluates the masterequation of one sector and writes it to toReturn.
+	* Like the main path it multiplies with the sparse block of the sector,
+	* whose columns are only rewritten if the edges of their state changed.
+	* Only the states of the sector are touched, so different sectors can be
+	* evaluated in parallel.
+	*/
+	void sectorODE(double time,const arma::Col<double>& probabilities,Sector& sector,arma::Col<double>& toReturn)
+	{
+		const std::vector<std::size_t>& states = sector.States;
+		bool rebuild = sector.Block.dimension() != states.size();
+
+		if(rebuild)
+		{
+			sector.WrittenVersions.assign(states.size(),0);
+		}
+
+		for(std::size_t k = 0;k < states.size();k++)
+		{
+			State& s = allStates[states[k]];
+			getProbabilities(time,s);
+
+			if(!rebuild && s.ratesVersion() != sector.WrittenVersions[k])
+			{
+				fillSectorColumn(sector,s);
+
+				if(sector.Block.updateColumn(k,sector.ColumnBuffer))
+				{
+					sector.WrittenVersions[k] = s.ratesVersion();
+				}
+				else
+				{
+					rebuild = true;
+				}
+			}
+		}
+
+		if(rebuild)
+		{
+			sector.Block.reset(states.size());
+
+			for(std::size_t k = 0;k < states.size();k++)
+			{
+				State& s = allStates[states[k]];
+
+				fillSectorColumn(sector,s);
+				sector.Block.appendColumn(k,sector.ColumnBuffer);
+				sector.WrittenVersions[k] = s.ratesVersion();
+			}
+		}
+
+		sector.Block.multiply(probabilities,toReturn);
+	}
 };
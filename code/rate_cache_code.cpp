@@ -0,0 +1,296 @@
+#pragma once
+#include<array>
+#include<list>
+#include<unordered_map>
+#include<vector>
+#include<mutex>
+#include<atomic>
+#include<string>
+#include<cstring>
+#include<cstdint>
+
+/**
+* A look-up-table for physical data that is expensive to calculate, like
+* transition rates. The values are identified by a key of KeySize doubles,
+* f.e. (energy, bias voltage, temperature, barrier). In a sweep, many systems
+* evaluate the same rates for the same parameters. If they share one RateCache,
+* every rate is only computed once.<br>
+* The cache can be used by multiple threads at once. It is split in shards
+* with a mutex each, so threads that ask for different keys rarely wait for
+* each other. Every shard holds a bounded number of values. If a shard is
+* full, the value that was used least recently is removed.<br>
+* Typical use in Edge::update or createEdges:
+*
+*	transitionProbabilitie = cache.get({E,U,T,gamma},[&](){return gamma*fermi(E,U,T);});
+*/
+template<std::size_t KeySize = 4>
+class RateCache
+{
+	public:
+
+	typedef std::array<double,KeySize> Key;
+
+	protected:
+
+	/**
+	* Returns the bit pattern of a component of a key. -0.0 and 0.0 are
+	* mapped to the same pattern, so they are the same key.
+	*/
+	static std::uint64_t bitsOf(double d)
+	{
+		if(d == 0)
+		{
+			d = 0;
+		}
+
+		std::uint64_t bits;
+		std::memcpy(&bits,&d,sizeof(bits));
+
+		return bits;
+	}
+
+	struct KeyHash
+	{
+		std::size_t operator()(const Key& key) const
+		{
+			//FNV-1a over the bit patterns of the doubles, followed by the
+			//finalizer of splitmix64 so that all bits are mixed.
+			std::uint64_t hash = 14695981039346656037ull;
+
+			for(double d : key)
+			{
+				hash ^= bitsOf(d);
+				hash *= 1099511628211ull;
+			}
+
+			hash ^= hash >> 30;
+			hash *= 0xbf58476d1ce4e5b9ull;
+			hash ^= hash >> 27;
+			hash *= 0x94d049bb133111ebull;
+			hash ^= hash >> 31;
+
+			return hash;
+		}
+	};
+
+	/**
+	* Compares keys by the same bit patterns the hash uses. With operator==
+	* a NaN would never find itself, so every lookup of a key with a NaN
+	* would add another entry to the index.
+	*/
+	struct KeyEqual
+	{
+		bool operator()(const Key& a,const Key& b) const
+		{
+			for(std::size_t i = 0;i < KeySize;i++)
+			{
+				if(bitsOf(a[i]) != bitsOf(b[i]))
+				{
+					return false;
+				}
+			}
+
+			return true;
+		}
+	};
+
+	/**
+	* One independent part of the cache. Which shard holds a key is decided
+	* by the hash of the key.
+	*/
+	struct Shard
+	{
+		std::mutex Mutex;
+
+		/**
+		* The cached values, the most recently used first.
+		*/
+		std::list<std::pair<Key,double>> Entries;
+
+		std::unordered_map<Key,typename std::list<std::pair<Key,double>>::iterator,KeyHash,KeyEqual> Index;
+	};
+
+	std::vector<Shard> Shards;
+
+	/**
+	* The maximal number of values per shard.
+	*/
+	std::size_t ShardCapacity;
+
+	std::atomic<std::uint64_t> Hits{0};
+	std::atomic<std::uint64_t> Misses{0};
+	std::atomic<std::uint64_t> Evictions{0};
+
+	Shard& shardOf(std::size_t hash)
+	{
+		return Shards[(hash >> 48) % Shards.size()];
+	}
+
+	public:
+
+	/**
+	* @param capacity The maximal number of values in the cache.
+	* @param shards The number of independent parts of the cache. More shards
+	* mean less waiting if many threads use the cache.
+	*/
+	RateCache(std::size_t capacity = 1<<20,std::size_t shards = 64):
+		Shards(shards),
+		ShardCapacity(capacity/shards > 0 ? capacity/shards : 1)
+	{}
+
+	/**
+	* Looks up the value of a key.
+	*
+	* @return true if the key was found. The value is written to value.
+	*/
+	bool find(const Key& key,double& value)
+	{
+		std::size_t hash = KeyHash()(key);
+		Shard& shard = shardOf(hash);
+
+		std::lock_guard<std::mutex> guard(shard.Mutex);
+
+		auto found = shard.Index.find(key);
+		if(found == shard.Index.end())
+		{
+			Misses++;
+			return false;
+		}
+
+		shard.Entries.splice(shard.Entries.begin(),shard.Entries,found->second);
+		value = found->second->second;
+		Hits++;
+
+		return true;
+	}
+
+	/**
+	* Stores the value of a key. The least recently used value of the shard is
+	* removed if the shard is full.
+	*/
+	void insert(const Key& key,double value)
+	{
+		std::size_t hash = KeyHash()(key);
+		Shard& shard = shardOf(hash);
+
+		std::lock_guard<std::mutex> guard(shard.Mutex);
+
+		auto found = shard.Index.find(key);
+		if(found != shard.Index.end())
+		{
+			found->second->second = value;
+			shard.Entries.splice(shard.Entries.begin(),shard.Entries,found->second);
+			return;
+		}
+
+		shard.Entries.push_front({key,value});
+		shard.Index[key] = shard.Entries.begin();
+
+		if(shard.Entries.size() > ShardCapacity)
+		{
+			shard.Index.erase(shard.Entries.back().first);
+			shard.Entries.pop_back();
+			Evictions++;
+		}
+	}
+
+	/**
+	* Returns the value of the key. If it is not cached yet, it is calculated
+	* with compute and stored. compute runs without holding a lock, so two
+	* threads may compute the same value at the same time.
+	*
+	* @param compute A function without parameters that returns the value.
+	*/
+	template<class Function>
+	double get(const Key& key,Function compute)
+	{
+		double value;
+
+		if(find(key,value))
+		{
+			return value;
+		}
+
+		value = compute();
+		insert(key,value);
+
+		return value;
+	}
+
+	/**
+	* Removes all values. The statistics are kept.
+	*/
+	void clear()
+	{
+		for(Shard& shard : Shards)
+		{
+			std::lock_guard<std::mutex> guard(shard.Mutex);
+			shard.Entries.clear();
+			shard.Index.clear();
+		}
+	}
+
+	/**
+	* Returns the number of values in the cache.
+	*/
+	std::size_t size()
+	{
+		std::size_t toReturn = 0;
+
+		for(Shard& shard : Shards)
+		{
+			std::lock_guard<std::mutex> guard(shard.Mutex);
+			toReturn += shard.Entries.size();
+		}
+
+		return toReturn;
+	}
+
+	std::uint64_t hits() const
+	{
+		return Hits;
+	}
+
+	std::uint64_t misses() const
+	{
+		return Misses;
+	}
+
+	std::uint64_t evictions() const
+	{
+		return Evictions;
+	}
+
+	/**
+	* Returns the fraction of lookups that were answered from the cache.
+	*/
+	double hitRate() const
+	{
+		std::uint64_t lookups = Hits + Misses;
+		return lookups == 0 ? 0 : (double)Hits/(double)lookups;
+	}
+
+	/**
+	* Returns the statistics as one line of text, f.e. to log them to the
+	* terminal after an experiment.
+	*/
+	std::string statistics()
+	{
+		return "RateCache: " + std::to_string(hits()) + " hits, " +
+			std::to_string(misses()) + " misses, " +
+			std::to_string(evictions()) + " evictions, " +
+			std::to_string(size()) + " values stored, hit rate " +
+			std::to_string(hitRate());
+	}
+};
+
+/**
+* A RateCache that is shared by all systems in the program. Systems that want
+* to share rates with systems of other experiments can use this one instead of
+* creating their own.
+*/
+inline RateCache<>& sharedRateCache()
+{
+	static RateCache<> cache;
+	return cache;
+}
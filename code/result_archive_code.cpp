@@ -0,0 +1,564 @@
+#pragma once
+#include<fstream>
+#include<string>
+#include<vector>
+#include<mutex>
+#include<algorithm>
+#include<stdexcept>
+#include<cstring>
+#include<cstdint>
+#include<set>
+#include<map>
+#include<functional>
+#include<sstream>
+#include<iomanip>
+#include<tuple>
+#include<cstdio>
+
+/**
+* Helpers for the binary output format (see QuantumSystem::writeToFile). All
+* numbers in the format are little endian, independent of the machine the
+* file is written on, so the files can be read with numpy.memmap anywhere.
+*/
+inline bool hostIsLittleEndian()
+{
+	const std::uint16_t probe = 1;
+	unsigned char firstByte;
+	std::memcpy(&firstByte,&probe,1);
+	return firstByte == 1;
+}
+
+/**
+* Writes n values of type T (an integer or a double) in little endian order.
+*/
+template<class T>
+void writeLittleEndian(std::ostream& file,const T* values,std::size_t n)
+{
+	if(hostIsLittleEndian())
+	{
+		file.write(reinterpret_cast<const char*>(values),n*sizeof(T));
+		return;
+	}
+
+	for(std::size_t i = 0;i < n;i++)
+	{
+		char bytes[sizeof(T)];
+		std::memcpy(bytes,values+i,sizeof(T));
+		std::reverse(bytes,bytes+sizeof(T));
+		file.write(bytes,sizeof(T));
+	}
+}
+
+inline void writeLittleEndian(std::ostream& file,std::uint64_t value)
+{
+	writeLittleEndian(file,&value,1);
+}
+
+inline void writeLittleEndian(std::ostream& file,double value)
+{
+	writeLittleEndian(file,&value,1);
+}
+
+/**
+* Strings are stored as their length in bytes followed by the characters.
+*/
+inline void writeLittleEndian(std::ostream& file,const std::string& value)
+{
+	writeLittleEndian(file,(std::uint64_t)value.size());
+	file.write(value.data(),value.size());
+}
+
+/**
+* Reads n values of type T that were written with writeLittleEndian.
+*/
+template<class T>
+void readLittleEndian(std::istream& file,T* values,std::size_t n)
+{
+	file.read(reinterpret_cast<char*>(values),n*sizeof(T));
+
+	if(!hostIsLittleEndian())
+	{
+		for(std::size_t i = 0;i < n;i++)
+		{
+			char bytes[sizeof(T)];
+			std::memcpy(bytes,values+i,sizeof(T));
+			std::reverse(bytes,bytes+sizeof(T));
+			std::memcpy(values+i,bytes,sizeof(T));
+		}
+	}
+}
+
+inline std::uint64_t readUInt64(std::istream& file)
+{
+	std::uint64_t value = 0;
+	readLittleEndian(file,&value,1);
+	return value;
+}
+
+inline std::string readString(std::istream& file)
+{
+	std::string value(readUInt64(file),'\0');
+	file.read(&value[0],value.size());
+	return value;
+}
+
+/**
+* Returns a 64 bit FNV-1a hash of the bytes as 16 hexadecimal digits. It is
+* used to identify topologies by their content.
+*/
+inline std::string contentHash(const std::string& bytes)
+{
+	std::uint64_t hash = 14695981039346656037ull;
+
+	for(unsigned char c : bytes)
+	{
+		hash ^= c;
+		hash *= 1099511628211ull;
+	}
+
+	std::ostringstream toReturn;
+	toReturn << std::hex << std::setw(16) << std::setfill('0') << hash;
+	return toReturn.str();
+}
+
+/**
+* In a sweep all measurements usually share the same energy levels and the
+* same graph of states and edges. A TopologyStore saves each topology only
+* once. The measurements only store their values and the hash of their
+* topology (see QuantumSystem::shareTopology).
+*/
+class TopologyStore
+{
+	public:
+
+	virtual ~TopologyStore() {}
+
+	/**
+	* Saves a topology if no topology with the same hash was saved before.
+	*
+	* @param write A function that takes a std::ostream& and writes the
+	* topology to it.
+	*/
+	virtual void store(const std::string& hash,const std::function<void(std::ostream&)>& write)=0;
+};
+
+/**
+* Saves every topology in a file of its own, <folder>/<hash>.topology.
+*/
+class FolderTopologyStore : public TopologyStore
+{
+	protected:
+
+	std::string Folder;
+
+	std::mutex Mutex;
+
+	std::set<std::string> Stored;
+
+	public:
+
+	FolderTopologyStore(std::string folder):
+		Folder(folder)
+	{}
+
+	void store(const std::string& hash,const std::function<void(std::ostream&)>& write) override
+	{
+		std::lock_guard<std::mutex> guard(Mutex);
+
+		if(Stored.count(hash) > 0)
+		{
+			return;
+		}
+
+		//The hash is only marked as stored once the file is complete, so a
+		//failed write is tried again by the next measurement instead of
+		//leaving it with a reference to a missing file.
+		std::string path = Folder + "/" + hash + ".topology";
+		std::ofstream file(path,std::ios::binary | std::ios::trunc);
+
+		if(file)
+		{
+			write(file);
+			file.close();
+		}
+
+		if(!file)
+		{
+			std::remove(path.c_str());
+			throw std::runtime_error("Could not write the topology " + path);
+		}
+
+		Stored.insert(hash);
+	}
+};
+
+/**
+* One file that holds the results of all measurements of an experiment. In
+* large sweeps, opening and closing one file per measurement costs more than
+* the small simulations themselves. The archive is only appended to. Each
+* measurement is stored in the binary output format of QuantumSystem (see
+* QuantumSystem::writeToBinaryFile). At the end, an index is appended that maps
+* the attribute values of every measurement to its position in the file, so
+* ResultArchiveReader can find a measurement without reading the others:
+*
+*	char[8]   "FSARCHIV"
+*	uint64    version (2)
+*	...       the measurements and topologies, each starting at a multiple
+*	          of 8 bytes
+*	uint64    number of attributes A, measurements M and topologies T
+*	A times   name of the attribute
+*	M times   offset and length of the measurement in bytes, A attribute values
+*	T times   hash, offset and length of the topology
+*	uint64    offset of the index
+*	char[8]   "FSINDEX"
+*
+* A measurement whose result was never written has the offset and length 0.
+* The archive is also a TopologyStore: shared topologies are appended once.
+* Many workerthreads can append at the same time. The archive writes the
+* results one after the other.
+*/
+class ResultArchive : public TopologyStore
+{
+	protected:
+
+	struct Record
+	{
+		std::vector<std::string> Attributes;
+		std::uint64_t Offset = 0;
+		std::uint64_t Length = 0;
+	};
+
+	std::string Path;
+
+	std::ofstream File;
+
+	/**
+	* Guards File and Records.
+	*/
+	std::mutex Mutex;
+
+	std::vector<std::string> AttributeNames;
+
+	std::vector<Record> Records;
+
+	/**
+	* The offset and length of every stored topology.
+	*/
+	std::map<std::string,std::pair<std::uint64_t,std::uint64_t>> Topologies;
+
+	bool Closed = false;
+
+	/**
+	* Appends the output of write at the next multiple of 8 bytes. The mutex
+	* must be locked.
+	*
+	* @return The offset and the length of the output.
+	*/
+	template<class Writer>
+	std::pair<std::uint64_t,std::uint64_t> appendLocked(Writer& write)
+	{
+		if(Closed)
+		{
+			throw std::runtime_error("The archive " + Path + " is already closed.");
+		}
+
+		std::uint64_t end = File.tellp();
+		File << std::string((8 - end%8)%8,'\0');
+
+		std::uint64_t offset = File.tellp();
+		write(File);
+		std::uint64_t length = (std::uint64_t)File.tellp() - offset;
+
+		if(!File)
+		{
+			throw std::runtime_error("Could not write to the archive " + Path);
+		}
+
+		return {offset,length};
+	}
+
+	public:
+
+	/**
+	* Creates the archive. An existing file at path is overwritten.
+	*
+	* @param attributeNames The names of the parameters that change from
+	* measurement to measurement (see Experiment::MetaDataSet).
+	*/
+	ResultArchive(std::string path,std::vector<std::string> attributeNames):
+		Path(path),
+		File(path,std::ios::binary | std::ios::trunc),
+		AttributeNames(attributeNames)
+	{
+		if(!File)
+		{
+			throw std::runtime_error("Could not open the archive " + Path);
+		}
+
+		File.write("FSARCHIV",8);
+		writeLittleEndian(File,(std::uint64_t)2);
+	}
+
+	~ResultArchive()
+	{
+		close();
+	}
+
+	/**
+	* Registers a measurement with the values of its attributes. The result
+	* is written later with append.
+	*
+	* @return The number of the measurement in the archive.
+	*/
+	std::size_t addRecord(const std::vector<std::string>& attributes)
+	{
+		if(attributes.size() != AttributeNames.size())
+		{
+			throw std::runtime_error("Number of Attributes in the archive don't match.");
+		}
+
+		std::lock_guard<std::mutex> guard(Mutex);
+
+		Records.push_back(Record{attributes});
+
+		return Records.size()-1;
+	}
+
+	/**
+	* Appends the result of a registered measurement to the archive.
+	*
+	* @param record The number addRecord returned for the measurement.
+	* @param write A function that takes a std::ostream& and writes the
+	* result to it. It is called while the archive is locked.
+	*/
+	template<class Writer>
+	void append(std::size_t record,Writer write)
+	{
+		std::lock_guard<std::mutex> guard(Mutex);
+
+		std::tie(Records[record].Offset,Records[record].Length) = appendLocked(write);
+	}
+
+	void store(const std::string& hash,const std::function<void(std::ostream&)>& write) override
+	{
+		std::lock_guard<std::mutex> guard(Mutex);
+
+		if(Topologies.count(hash))
+		{
+			return;
+		}
+
+		Topologies[hash] = appendLocked(write);
+	}
+
+	/**
+	* Writes the index and closes the file. Nothing can be appended
+	* afterwards. It is called by the destructor if it was not called before.
+	*/
+	void close()
+	{
+		std::lock_guard<std::mutex> guard(Mutex);
+
+		if(Closed)
+		{
+			return;
+		}
+
+		std::uint64_t indexOffset = File.tellp();
+
+		writeLittleEndian(File,(std::uint64_t)AttributeNames.size());
+		writeLittleEndian(File,(std::uint64_t)Records.size());
+		writeLittleEndian(File,(std::uint64_t)Topologies.size());
+		for(std::string& name : AttributeNames)
+		{
+			writeLittleEndian(File,name);
+		}
+		for(Record& r : Records)
+		{
+			writeLittleEndian(File,r.Offset);
+			writeLittleEndian(File,r.Length);
+			for(std::string& value : r.Attributes)
+			{
+				writeLittleEndian(File,value);
+			}
+		}
+		for(auto& t : Topologies)
+		{
+			writeLittleEndian(File,t.first);
+			writeLittleEndian(File,t.second.first);
+			writeLittleEndian(File,t.second.second);
+		}
+
+		writeLittleEndian(File,indexOffset);
+		File.write("FSINDEX\0",8);
+
+		File.close();
+		Closed = true;
+	}
+
+	std::string path()
+	{
+		return Path;
+	}
+};
+
+/**
+* Reads the measurements from a closed ResultArchive. Only the index is read
+* when the archive is opened. tools/binaryResults.py can read archives too.
+*/
+class ResultArchiveReader
+{
+	protected:
+
+	std::ifstream File;
+
+	std::vector<std::string> AttributeNames;
+
+	std::vector<std::vector<std::string>> Attributes;
+
+	std::vector<std::uint64_t> Offsets;
+
+	std::vector<std::uint64_t> Lengths;
+
+	std::map<std::string,std::pair<std::uint64_t,std::uint64_t>> Topologies;
+
+	std::string readBytes(std::uint64_t offset,std::uint64_t length)
+	{
+		std::string toReturn(length,'\0');
+
+		File.clear();
+		File.seekg(offset);
+		File.read(&toReturn[0],toReturn.size());
+
+		return toReturn;
+	}
+
+	public:
+
+	ResultArchiveReader(std::string path):
+		File(path,std::ios::binary)
+	{
+		char magic[8];
+		File.read(magic,8);
+		if(!File || std::memcmp(magic,"FSARCHIV",8) != 0)
+		{
+			throw std::runtime_error(path + " is no result archive.");
+		}
+
+		std::uint64_t version = readUInt64(File);
+		if(version != 1 && version != 2)
+		{
+			throw std::runtime_error("Unknown version " + std::to_string(version) + " of the archive " + path);
+		}
+
+		File.seekg(-16,std::ios::end);
+		std::uint64_t indexOffset = readUInt64(File);
+		File.read(magic,8);
+		if(!File || std::memcmp(magic,"FSINDEX\0",8) != 0)
+		{
+			throw std::runtime_error("The archive " + path + " has no index. It was not closed.");
+		}
+
+		File.seekg(indexOffset);
+		std::size_t attributeCount = readUInt64(File);
+		std::size_t recordCount = readUInt64(File);
+		std::size_t topologyCount = version >= 2 ? readUInt64(File) : 0;
+
+		for(std::size_t a = 0;a < attributeCount;a++)
+		{
+			AttributeNames.push_back(readString(File));
+		}
+
+		for(std::size_t r = 0;r < recordCount;r++)
+		{
+			Offsets.push_back(readUInt64(File));
+			Lengths.push_back(readUInt64(File));
+
+			std::vector<std::string> values;
+			for(std::size_t a = 0;a < attributeCount;a++)
+			{
+				values.push_back(readString(File));
+			}
+			Attributes.push_back(values);
+		}
+
+		for(std::size_t t = 0;t < topologyCount;t++)
+		{
+			std::string hash = readString(File);
+			std::uint64_t offset = readUInt64(File);
+			Topologies[hash] = {offset,readUInt64(File)};
+		}
+
+		if(!File)
+		{
+			throw std::runtime_error("The index of the archive " + path + " is damaged.");
+		}
+	}
+
+	/**
+	* Returns the number of measurements in the archive.
+	*/
+	std::size_t size()
+	{
+		return Offsets.size();
+	}
+
+	const std::vector<std::string>& attributeNames()
+	{
+		return AttributeNames;
+	}
+
+	/**
+	* Returns the attribute values of a measurement.
+	*/
+	const std::vector<std::string>& attributes(std::size_t record)
+	{
+		return Attributes.at(record);
+	}
+
+	/**
+	* Returns the position of a measurement in the file, f.e. to map it with
+	* numpy.memmap.
+	*/
+	std::uint64_t offset(std::size_t record)
+	{
+		return Offsets.at(record);
+	}
+
+	std::uint64_t length(std::size_t record)
+	{
+		return Lengths.at(record);
+	}
+
+	/**
+	* Returns the number of the first measurement with the given attribute
+	* values or size() if there is none.
+	*/
+	std::size_t find(const std::vector<std::string>& attributes)
+	{
+		return std::find(Attributes.begin(),Attributes.end(),attributes) - Attributes.begin();
+	}
+
+	/**
+	* Returns the result of a measurement in the binary output format.
+	*/
+	std::string read(std::size_t record)
+	{
+		return readBytes(Offsets.at(record),Lengths.at(record));
+	}
+
+	/**
+	* Returns a topology that was stored in the archive by a measurement
+	* with a shared topology (see QuantumSystem::shareTopology).
+	*/
+	std::string readTopology(const std::string& hash)
+	{
+		auto found = Topologies.find(hash);
+		if(found == Topologies.end())
+		{
+			throw std::runtime_error("There is no topology " + hash + " in the archive.");
+		}
+
+		return readBytes(found->second.first,found->second.second);
+	}
+};
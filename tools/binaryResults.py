@@ -0,0 +1,290 @@
+#!/bin/python
+# Utility for the binary result files written by QuantumSystem::writeToFile
+# with the binary output format. The format is described at
+# QuantumSystem::writeToBinaryFile. The matrices are mapped with numpy.memmap,
+# so nothing is copied until the values are used.
+#
+# Used as a script, it converts a binary result file to the graphml file the
+# cpp code would have written:
+#	python binaryResults.py <binary file> [<graphml file>]
+# A measurement in a result archive (see ResultArchive) is converted with:
+#	python binaryResults.py <archive> <number of the measurement> [<graphml file>]
+
+import os
+import struct
+import sys
+import numpy as np
+
+class Reader:
+	def __init__(self,data):
+		self.Data = data
+		self.Position = 0
+
+	def uint64(self):
+		value = struct.unpack_from('<Q',self.Data,self.Position)[0]
+		self.Position += 8
+		return value
+
+	def float64(self):
+		value = struct.unpack_from('<d',self.Data,self.Position)[0]
+		self.Position += 8
+		return value
+
+	def string(self):
+		length = self.uint64()
+		value = bytes(self.Data[self.Position:self.Position+length]).decode('utf-8')
+		self.Position += length
+		return value
+
+def readNiveaus(reader,niveauCount):
+	niveaus = []
+	for i in range(0,niveauCount):
+		niveau = {}
+		niveau['name'] = reader.string()
+		niveau['energy'] = reader.float64()
+		niveau['spin'] = reader.float64()
+		niveau['charge'] = reader.float64()
+		niveaus.append(niveau)
+	return niveaus
+
+# Loads a topology file written by QuantumSystem::writeTopology.
+def loadTopology(pathToTopology,offset=0):
+	data = np.memmap(pathToTopology,dtype=np.uint8,mode='r',offset=offset)
+
+	if bytes(data[0:8]) != b'FSTOPOLO':
+		raise ValueError(pathToTopology + " is no topology file.")
+
+	reader = Reader(data)
+	reader.Position = 16
+
+	niveauCount = reader.uint64()
+	stateCount = reader.uint64()
+	edgeCount = reader.uint64()
+
+	topology = {}
+	topology['niveaus'] = readNiveaus(reader,niveauCount)
+	topology['states'] = [reader.uint64() for i in range(0,stateCount)]
+
+	topology['edgeSource'] = [0]*edgeCount
+	topology['edgeTarget'] = [0]*edgeCount
+	topology['edgeIds'] = ['']*edgeCount
+	for i in range(0,edgeCount):
+		topology['edgeSource'][i] = reader.uint64()
+		topology['edgeTarget'][i] = reader.uint64()
+		topology['edgeIds'][i] = reader.string()
+
+	return topology
+
+# Loads a binary result file. Results in an archive start at offset. Files
+# that only hold the values of the keyframes (QuantumSystem::writeSeries)
+# are completed with their topology. It is searched in topologies, a dict
+# of hash: (path,offset), or next to the file.
+def load(pathToData,offset=0,topologies=None):
+	data = np.memmap(pathToData,dtype=np.uint8,mode='r',offset=offset)
+	magic = bytes(data[0:8])
+
+	if magic != b'FSRESULT' and magic != b'FSSERIES':
+		raise ValueError(pathToData + " is no binary result file.")
+
+	reader = Reader(data)
+	reader.Position = 8
+
+	version = reader.uint64()
+	if version != 1:
+		raise ValueError("Unknown version " + str(version) + " of " + pathToData)
+
+	dataOffset = reader.uint64()
+	niveauCount = reader.uint64() if magic == b'FSRESULT' else 0
+	stateCount = reader.uint64()
+	edgeCount = reader.uint64()
+	keyframeCount = reader.uint64()
+
+	result = {}
+
+	if magic == b'FSSERIES':
+		hash = reader.string()
+		result['designator'] = reader.string()
+
+		if topologies is None:
+			topologies = {hash: (os.path.join(os.path.dirname(pathToData),hash + '.topology'),0)}
+		result.update(loadTopology(*topologies[hash]))
+
+		result['stateFirstKeyframe'] = [reader.uint64() for i in range(0,stateCount)]
+		result['edgeFirstKeyframe'] = [reader.uint64() for i in range(0,edgeCount)]
+	else:
+		result['designator'] = reader.string()
+		result['niveaus'] = readNiveaus(reader,niveauCount)
+
+		result['states'] = [0]*stateCount
+		result['stateFirstKeyframe'] = [0]*stateCount
+		for i in range(0,stateCount):
+			result['states'][i] = reader.uint64()
+			result['stateFirstKeyframe'][i] = reader.uint64()
+
+		result['edgeSource'] = [0]*edgeCount
+		result['edgeTarget'] = [0]*edgeCount
+		result['edgeFirstKeyframe'] = [0]*edgeCount
+		result['edgeIds'] = ['']*edgeCount
+		for i in range(0,edgeCount):
+			result['edgeSource'][i] = reader.uint64()
+			result['edgeTarget'][i] = reader.uint64()
+			result['edgeFirstKeyframe'][i] = reader.uint64()
+			result['edgeIds'][i] = reader.string()
+
+	dataOffset += offset
+	occupationOffset = dataOffset + 8*keyframeCount
+	rateOffset = occupationOffset + 8*keyframeCount*stateCount
+
+	result['times'] = np.memmap(pathToData,dtype='<f8',mode='r',
+			offset=dataOffset,shape=(keyframeCount,))
+	result['occupation'] = np.memmap(pathToData,dtype='<f8',mode='r',
+			offset=occupationOffset,shape=(keyframeCount,stateCount))
+	result['rates'] = np.memmap(pathToData,dtype='<f8',mode='r',
+			offset=rateOffset,shape=(keyframeCount,edgeCount))
+
+	return result
+
+# Reads the index of a result archive. Returns the names of the attributes,
+# one entry per measurement with its offset, length and attribute values and
+# the topologies in the archive as a dict of hash: (path,offset).
+def loadArchiveIndex(pathToArchive):
+	data = np.memmap(pathToArchive,dtype=np.uint8,mode='r')
+
+	if bytes(data[0:8]) != b'FSARCHIV':
+		raise ValueError(pathToArchive + " is no result archive.")
+	if bytes(data[-8:]) != b'FSINDEX\0':
+		raise ValueError("The archive " + pathToArchive + " has no index. It was not closed.")
+
+	reader = Reader(data)
+	reader.Position = 8
+	version = reader.uint64()
+
+	reader.Position = len(data) - 16
+	reader.Position = reader.uint64()
+
+	attributeCount = reader.uint64()
+	recordCount = reader.uint64()
+	topologyCount = reader.uint64() if version >= 2 else 0
+
+	attributeNames = [reader.string() for a in range(0,attributeCount)]
+
+	records = []
+	for r in range(0,recordCount):
+		record = {}
+		record['offset'] = reader.uint64()
+		record['length'] = reader.uint64()
+		record['attributes'] = [reader.string() for a in range(0,attributeCount)]
+		records.append(record)
+
+	topologies = {}
+	for t in range(0,topologyCount):
+		hash = reader.string()
+		topologies[hash] = (pathToArchive,reader.uint64())
+		reader.uint64()
+
+	return attributeNames,records,topologies
+
+# Loads one measurement of a result archive like load does.
+def loadFromArchive(pathToArchive,record):
+	attributeNames,records,topologies = loadArchiveIndex(pathToArchive)
+	return load(pathToArchive,records[record]['offset'],topologies)
+
+# The same keys as QuantumSystem::timeKeys.
+def timeKeys(times):
+	keys = []
+	used = set()
+
+	for k in range(0,len(times)):
+		key = '%f' % times[k]
+
+		if key in used:
+			key = '%.17g' % times[k]
+		if key in used:
+			key += '_' + str(k)
+
+		used.add(key)
+		keys.append(key)
+
+	return keys
+
+# Formats a value like an ostream with the default settings does.
+def formatValue(value):
+	return '%g' % value
+
+def writeData(file,indent,keys,values,firstKeyframe):
+	for k in range(firstKeyframe,len(keys)):
+		file.write(indent + '<data key="' + keys[k] + '">' + formatValue(values[k]) + '</data>\n')
+
+def toGraphml(pathToData,pathToGraphml,offset=0,topologies=None):
+	result = load(pathToData,offset,topologies)
+	designator = result['designator']
+
+	keys = timeKeys(result['times'])
+	nodeDataKeys = [designator + 'Occupation_@_' + t for t in keys]
+	edgeDataKeys = [designator + 'Wheights_@_' + t for t in keys]
+
+	with open(pathToGraphml,'w') as file:
+		file.write('<?xml version="1.0" encoding="UTF-8"?>\n\n')
+		file.write('<RunData>\n')
+
+		file.write('<SystemInformation xmlns="SystemInfo">\n')
+		for n in result['niveaus']:
+			file.write('\t<niveau>\n')
+			file.write('\t\t<name> ' + n['name'] + '</name>\n')
+			file.write('\t\t<energy_in_eV> ' + formatValue(n['energy']) + '</energy_in_eV>\n')
+			file.write('\t\t<Spin> ' + formatValue(n['spin']) + '</Spin>\n')
+			file.write('\t\t<Charge> ' + formatValue(n['charge']) + '</Charge>\n')
+			file.write('\t</niveau>\n')
+		file.write('</SystemInformation>\n\n')
+
+		file.write('<graphml xmlns="GraphInfo">\n')
+		for t in keys:
+			file.write('\t<key attr.name="' + designator + 'Occupation_At_t=' + t)
+			file.write('" attr.type="float" for="node" id="')
+			file.write(designator + 'Occupation_@_' + t + '"/> \n')
+			file.write('\t<key attr.name="' + designator + 'Wheights_At_t=' + t)
+			file.write('" attr.type="float" for="edge" id="')
+			file.write(designator + 'Wheights_@_' + t + '"/> \n')
+
+		file.write('<graph edgedefault="directed">\n')
+
+		occupation = result['occupation']
+		rates = result['rates']
+		edge = 0
+
+		for n in range(0,len(result['states'])):
+			state = result['states'][n]
+
+			file.write('\t<node id="' + str(state) + '">\n')
+			writeData(file,'\t\t',nodeDataKeys,occupation[:,n],result['stateFirstKeyframe'][n])
+			file.write('\t</node>\n')
+
+			while edge < len(result['edgeSource']) and result['edgeSource'][edge] == state:
+				file.write('\t\t<edge id="' + result['edgeIds'][edge] + '" ')
+				file.write('source="' + str(state) + '" ')
+				file.write('target="' + str(result['edgeTarget'][edge]) + '">\n')
+				writeData(file,'\t\t\t',edgeDataKeys,rates[:,edge],result['edgeFirstKeyframe'][edge])
+				file.write('\t\t</edge>\n')
+				edge += 1
+
+		file.write('</graph>\n')
+		file.write('</graphml>\n')
+		file.write('</RunData>')
+
+if __name__ == "__main__":
+	if len(sys.argv) < 2:
+		print("Usage: python binaryResults.py <binary file> [<graphml file>]")
+		print("       python binaryResults.py <archive> <number of the measurement> [<graphml file>]")
+		sys.exit(1)
+
+	with open(sys.argv[1],'rb') as file:
+		isArchive = file.read(8) == b'FSARCHIV'
+
+	if isArchive:
+		record = int(sys.argv[2])
+		attributeNames,records,topologies = loadArchiveIndex(sys.argv[1])
+		pathToGraphml = sys.argv[3] if len(sys.argv) > 3 else sys.argv[1] + '#' + str(record) + '.graphml'
+		toGraphml(sys.argv[1],pathToGraphml,records[record]['offset'],topologies)
+	else:
+		pathToGraphml = sys.argv[2] if len(sys.argv) > 2 else sys.argv[1] + '.graphml'
+		toGraphml(sys.argv[1],pathToGraphml)
@@ -0,0 +1,139 @@
+/**
+* Accuracy test of the batch versions of the Fermi-Dirac-distribution in
+* physicalFormulas.cpp. Every implementation the processor supports (scalar,
+* AVX2, AVX-512) is run directly, independent of the runtime dispatch, and
+* compared with the scalar fermi over the whole range of exponents where the
+* vectorized exp is not clamped (-708 to 708) and densely around the
+* crossover E = eU. It returns 1 if the maximal relative error of one of them
+* exceeds the tolerance.
+*
+* Compile and run from the root of the repository:
+*	g++ tools/fermiAccuracy.cpp -std=c++17 -O3 -I code -o fermiAccuracy.out
+*	./fermiAccuracy.out
+*/
+#include<cstdio>
+#include<vector>
+#include<cmath>
+#include "physicalFormulas.cpp"
+
+typedef void (*Kernel)(const double*,std::size_t,double,double,double,double,double*);
+
+const double Tolerance = 1e-14;
+
+/**
+* The exponents (E - eU)/(k_b*T) the kernels are tested with.
+*/
+std::vector<double> testExponents()
+{
+	std::vector<double> x;
+
+	//The whole range in steps that are no multiple of the vector width.
+	for(double v = -fermiExponentLimit;v <= fermiExponentLimit;v += 1.0/1021)
+	{
+		x.push_back(v);
+	}
+
+	//The crossover, where f is close to 1/2.
+	for(double v = -1;v <= 1;v += 1.0/65537)
+	{
+		x.push_back(v);
+	}
+
+	//The boundaries of the range and the points where the reduction
+	//k = round(x/ln2) changes.
+	x.push_back(fermiExponentLimit);
+	x.push_back(-fermiExponentLimit);
+	for(int k = -1021;k <= 1021;k++)
+	{
+		double boundary = (k + 0.5)*M_LN2;
+		if(std::abs(boundary) < fermiExponentLimit)
+		{
+			x.push_back(std::nextafter(boundary,-1e300));
+			x.push_back(std::nextafter(boundary,1e300));
+		}
+	}
+
+	x.push_back(0);
+
+	return x;
+}
+
+/**
+* Returns the maximal relative error of a kernel against the scalar fermi.
+*/
+double maximalError(Kernel kernel,const std::vector<double>& x,double sign,double& worstExponent)
+{
+	//1-f(E) is compared with f at the energy mirrored at eU. With U = 0 the
+	//mirrored energy -E is exact, otherwise the rounding of 2eU - E would
+	//dominate the error.
+	const double U = sign > 0 ? 0.01 : 0;
+	const double T = 4;
+	const double scale = 3.5e9;
+
+	std::vector<double> E(x.size());
+	for(std::size_t i = 0;i < x.size();i++)
+	{
+		E[i] = x[i]*k_b*T + e_minus*U;
+	}
+
+	std::vector<double> out(x.size());
+	kernel(E.data(),E.size(),U,T,sign,scale,out.data());
+
+	double worst = 0;
+	for(std::size_t i = 0;i < x.size();i++)
+	{
+		double reference = scale*(sign > 0 ? fermi(E[i],U,T) : fermi(-E[i],U,T));
+		double error = std::abs(out[i] - reference)/reference;
+
+		if(!(error <= worst))
+		{
+			worst = error;
+			worstExponent = x[i];
+		}
+	}
+
+	return worst;
+}
+
+int main()
+{
+	struct Implementation
+	{
+		const char* Name;
+		Kernel Function;
+		bool Supported;
+	};
+
+	std::vector<Implementation> implementations = {{"scalar",fermiBatchScalar,true}};
+
+#ifdef FLUXSURFER_X86_DISPATCH
+	__builtin_cpu_init();
+	implementations.push_back({"AVX2",fermiBatchAVX2,__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")});
+	implementations.push_back({"AVX-512",fermiBatchAVX512,(bool)__builtin_cpu_supports("avx512f")});
+#endif
+
+	std::vector<double> x = testExponents();
+	bool failed = false;
+
+	for(Implementation& i : implementations)
+	{
+		if(!i.Supported)
+		{
+			std::printf("%-8s not supported by this processor, skipped\n",i.Name);
+			continue;
+		}
+
+		for(double sign : {1.0,-1.0})
+		{
+			double worstExponent = 0;
+			double error = maximalError(i.Function,x,sign,worstExponent);
+			bool passed = error <= Tolerance;
+			failed = failed || !passed;
+
+			std::printf("%-8s %s maximal relative error %.3e at x = %.6g: %s\n",
+				i.Name,sign > 0 ? "f(E)  " : "1-f(E)",error,worstExponent,passed ? "passed" : "FAILED");
+		}
+	}
+
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,111 @@
+/**
+* Microbenchmark of the Fermi-Dirac-distribution. It compares the scalar
+* fermi called once per energy, as Edge::update implementations do, with
+* every batch implementation the processor supports (scalar, AVX2, AVX-512)
+* and the runtime dispatch fermiBatch, for batches of different sizes.
+*
+* Compile and run from the root of the repository:
+*	g++ tools/fermiBenchmark.cpp -std=c++17 -O3 -I code -o fermiBenchmark.out
+*	./fermiBenchmark.out
+*/
+#include<chrono>
+#include<cstdio>
+#include<functional>
+#include<vector>
+#include "physicalFormulas.cpp"
+
+typedef void (*Kernel)(const double*,std::size_t,double,double,double,double,double*);
+
+/**
+* Returns the time per energy in ns. The call is repeated until about 0.2 s
+* of work are done.
+*/
+double nanosecondsPerValue(const std::function<void()>& call,std::size_t n)
+{
+	//Warm up the caches and the dispatch.
+	call();
+
+	std::size_t repetitions = 1;
+	while(true)
+	{
+		auto begin = std::chrono::steady_clock::now();
+		for(std::size_t r = 0;r < repetitions;r++)
+		{
+			call();
+		}
+		double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+
+		if(seconds > 0.2)
+		{
+			return seconds*1e9/(repetitions*n);
+		}
+
+		repetitions *= 2;
+	}
+}
+
+int main()
+{
+	const double U = 0.01;
+	const double T = 4;
+
+	struct Implementation
+	{
+		const char* Name;
+		Kernel Function;
+		bool Supported;
+	};
+
+	std::vector<Implementation> implementations = {{"batch scalar",fermiBatchScalar,true}};
+
+#ifdef FLUXSURFER_X86_DISPATCH
+	__builtin_cpu_init();
+	implementations.push_back({"batch AVX2",fermiBatchAVX2,__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")});
+	implementations.push_back({"batch AVX-512",fermiBatchAVX512,(bool)__builtin_cpu_supports("avx512f")});
+#endif
+
+	implementations.push_back({"fermiBatch",fermiBatch,true});
+
+	//The sink keeps the compiler from removing the calls.
+	volatile double sink = 0;
+
+	for(std::size_t n : {8,64,1024,65536})
+	{
+		//Energies a few k_b*T around the chemical potential, like the levels
+		//of a dot close to resonance.
+		std::vector<double> E(n);
+		for(std::size_t i = 0;i < n;i++)
+		{
+			E[i] = e_minus*U + (double(i)/n - 0.5)*40*k_b*T;
+		}
+		std::vector<double> out(n);
+
+		std::printf("%zu energies\n",n);
+
+		double scalar = nanosecondsPerValue([&]()
+		{
+			for(std::size_t i = 0;i < n;i++)
+			{
+				out[i] = fermi(E[i],U,T);
+			}
+			sink = sink + out[n/2];
+		},n);
+		std::printf("\t%-14s %7.3f ns per value\n","scalar fermi",scalar);
+
+		for(Implementation& i : implementations)
+		{
+			if(!i.Supported)
+			{
+				std::printf("\t%-14s not supported by this processor\n",i.Name);
+				continue;
+			}
+
+			double t = nanosecondsPerValue([&]()
+			{
+				i.Function(E.data(),n,U,T,1,1,out.data());
+				sink = sink + out[n/2];
+			},n);
+			std::printf("\t%-14s %7.3f ns per value, speedup %5.2f\n",i.Name,t,scalar/t);
+		}
+	}
+}